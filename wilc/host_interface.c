@@ -1415,11 +1415,8 @@ static s32 wilc_parse_network_info(struct wilc_vif *vif, u8 *msg_buffer,
 	return 0;
 }
 
-static void handle_rcvd_ntwrk_info(struct work_struct *work)
+static void wilc_process_ntwrk_info(struct wilc_vif *vif, u8 *buffer)
 {
-	struct host_if_msg *msg = container_of(work, struct host_if_msg, work);
-	struct wilc_vif *vif = msg->vif;
-	struct rcvd_net_info *rcvd_info = &msg->body.net_info;
 	u32 i;
 	bool found;
 	struct network_info *info = NULL;
@@ -1432,11 +1429,11 @@ static void handle_rcvd_ntwrk_info(struct work_struct *work)
 	PRINT_D(vif->ndev, HOSTINF_DBG, "Handling received network info\n");
 
 	if (!scan_req->scan_result)
-		goto done;
+		return;
 
 	PRINT_INFO(vif->ndev, HOSTINF_DBG,
 		   "State: Scanning, parsing network information received\n");
-	ret = wilc_parse_network_info(vif, rcvd_info->buffer, &info);
+	ret = wilc_parse_network_info(vif, buffer, &info);
 	if (ret || !info || !scan_req->scan_result) {
 		PRINT_ER(vif->ndev, "info or scan result NULL\n");
 		goto done;
@@ -1482,17 +1479,177 @@ static void handle_rcvd_ntwrk_info(struct work_struct *work)
 	}
 
 done:
-	kfree(rcvd_info->buffer);
-	rcvd_info->buffer = NULL;
-
 	if (info) {
 		kfree(info->ies);
 		kfree(info);
 	}
+}
 
+static void handle_rcvd_ntwrk_info(struct work_struct *work)
+{
+	struct host_if_msg *msg = container_of(work, struct host_if_msg, work);
+	struct rcvd_net_info *rcvd_info = &msg->body.net_info;
+
+	wilc_process_ntwrk_info(msg->vif, rcvd_info->buffer);
+
+	kfree(rcvd_info->buffer);
+	rcvd_info->buffer = NULL;
 	kfree(msg);
 }
 
+/*
+ * Runs on hif_workqueue, so the batch is handled in order with the rest of
+ * the scan work items, e.g. before a queued scan-complete.
+ */
+static void wilc_scan_coalesce_flush_work(struct work_struct *work)
+{
+	struct wilc_scan_coalescer *c;
+	int i, count;
+
+	c = container_of(to_delayed_work(work), struct wilc_scan_coalescer,
+			 flush_work);
+
+	mutex_lock(&c->lock);
+	count = c->count;
+	memcpy(c->batch, c->ent, count * sizeof(c->ent[0]));
+	memset(c->ent, 0, count * sizeof(c->ent[0]));
+	c->count = 0;
+	mutex_unlock(&c->lock);
+
+	PRINT_D(c->vif->ndev, HOSTINF_DBG,
+		"Flushing %d coalesced networks, %u merged\n", count,
+		c->merged);
+
+	for (i = 0; i < count; i++) {
+		wilc_process_ntwrk_info(c->vif, c->batch[i].buffer);
+		kfree(c->batch[i].buffer);
+		c->batch[i].buffer = NULL;
+	}
+}
+
+static void wilc_scan_coalesce_init(struct wilc_vif *vif,
+				    struct wilc_scan_coalescer *c)
+{
+	mutex_init(&c->lock);
+	INIT_DELAYED_WORK(&c->flush_work, wilc_scan_coalesce_flush_work);
+	c->vif = vif;
+}
+
+static void wilc_scan_coalesce_deinit(struct wilc_scan_coalescer *c)
+{
+	int i;
+
+	cancel_delayed_work_sync(&c->flush_work);
+	for (i = 0; i < c->count; i++)
+		kfree(c->ent[i].buffer);
+	c->count = 0;
+	mutex_destroy(&c->lock);
+}
+
+/* Hand whatever has been coalesced so far to the scan handler now. */
+static void wilc_scan_coalesce_kick(struct wilc *wilc,
+				    struct wilc_scan_coalescer *c)
+{
+	mod_delayed_work(wilc->hif_workqueue, &c->flush_work, 0);
+}
+
+/*
+ * Peek at the BSSID and RSSI of a raw 'N' message without allocating.
+ * Returns false for anything that wilc_parse_network_info() would reject.
+ */
+static bool wilc_peek_network_info(u8 *buffer, u32 length, u8 **bssid,
+				   s8 *rssi)
+{
+	struct ieee80211_mgmt *mgt;
+	u16 wid_len;
+
+	if (length < 9 || buffer[0] != 'N')
+		return false;
+
+	wid_len = get_unaligned_le16(&buffer[6]);
+	if (wid_len < 1 + offsetof(struct ieee80211_mgmt, u.beacon.variable) ||
+	    8 + wid_len > length)
+		return false;
+
+	mgt = (struct ieee80211_mgmt *)&buffer[9];
+	if (!ieee80211_is_probe_resp(mgt->frame_control) &&
+	    !ieee80211_is_beacon(mgt->frame_control))
+		return false;
+
+	*rssi = buffer[8];
+	*bssid = get_bssid(mgt);
+
+	return true;
+}
+
+/*
+ * Returns false if the frame couldn't be coalesced because the table is
+ * full, the caller then delivers it on its own.
+ */
+static bool wilc_scan_coalesce_add(struct wilc_vif *vif, u8 *buffer,
+				   u32 length, u8 *bssid, s8 rssi)
+{
+	struct wilc_scan_coalescer *c = &vif->hif_drv->scan_coalesce;
+	struct wilc_scan_coalesce_entry *e = NULL;
+	bool arm = false, full = false, taken = true;
+	int i;
+
+	mutex_lock(&c->lock);
+	for (i = 0; i < c->count; i++) {
+		if (ether_addr_equal_unaligned(c->ent[i].bssid, bssid)) {
+			e = &c->ent[i];
+			break;
+		}
+	}
+
+	if (e) {
+		c->merged++;
+		if (rssi < e->rssi)
+			goto unlock;
+		/* newer sample with better or equal RSSI replaces the old one */
+		if (length > e->size) {
+			u8 *buf = kmalloc(length, GFP_KERNEL);
+
+			if (!buf)
+				goto unlock;
+			kfree(e->buffer);
+			e->buffer = buf;
+			e->size = length;
+		}
+	} else {
+		if (c->count == WILC_SCAN_COALESCE_SLOTS) {
+			/* the flush is already kicked, don't lose the BSS */
+			taken = false;
+			goto unlock;
+		}
+
+		e = &c->ent[c->count];
+		e->buffer = kmalloc(length, GFP_KERNEL);
+		if (!e->buffer)
+			goto unlock;
+		e->size = length;
+		ether_addr_copy(e->bssid, bssid);
+		arm = (c->count == 0);
+		c->count++;
+		full = (c->count == WILC_SCAN_COALESCE_SLOTS);
+	}
+
+	memcpy(e->buffer, buffer, length);
+	e->len = length;
+	e->rssi = rssi;
+
+unlock:
+	mutex_unlock(&c->lock);
+
+	if (full)
+		wilc_scan_coalesce_kick(vif->wilc, c);
+	else if (arm)
+		queue_delayed_work(vif->wilc->hif_workqueue, &c->flush_work,
+				   msecs_to_jiffies(WILC_SCAN_COALESCE_MS));
+
+	return taken;
+}
+
 static void host_int_get_assoc_res_info(struct wilc_vif *vif,
 				       u8 *assoc_resp_info,
 				       u32 max_assoc_resp_info_len,
@@ -3891,6 +4048,7 @@ int wilc_init(struct net_device *dev, struct host_if_drv **hif_drv_handler)
 	hif_drv->hif_state = HOST_IF_IDLE;
 
 	hif_drv->p2p_timeout = 0;
+	wilc_scan_coalesce_init(vif, &hif_drv->scan_coalesce);
 
 	wilc->clients_count++;
 
@@ -3930,6 +4088,7 @@ int wilc_deinit(struct wilc_vif *vif)
 
 	hif_drv->hif_state = HOST_IF_IDLE;
 
+	wilc_scan_coalesce_deinit(&hif_drv->scan_coalesce);
 	kfree(hif_drv);
 
 	vif->wilc->clients_count--;
@@ -3945,6 +4104,8 @@ void wilc_network_info_received(struct wilc *wilc, u8 *buffer, u32 length)
 	int id;
 	struct host_if_drv *hif_drv;
 	struct wilc_vif *vif;
+	u8 *bssid;
+	s8 rssi;
 
 	id = buffer[length - 4];
 	id |= (buffer[length - 3] << 8);
@@ -3960,6 +4121,14 @@ void wilc_network_info_received(struct wilc *wilc, u8 *buffer, u32 length)
 		return;
 	}
 
+	/* nothing would consume it outside of a scan */
+	if (!hif_drv->usr_scan_req.scan_result)
+		return;
+
+	if (wilc_peek_network_info(buffer, length, &bssid, &rssi) &&
+	    wilc_scan_coalesce_add(vif, buffer, length, bssid, rssi))
+		return;
+
 	msg = wilc_alloc_work(vif, handle_rcvd_ntwrk_info, false);
 	if (IS_ERR(msg))
 		return;
@@ -4064,6 +4233,9 @@ void wilc_scan_complete_received(struct wilc *wilc, u8 *buffer, u32 length)
 	if (hif_drv->usr_scan_req.scan_result) {
 		struct host_if_msg *msg;
 
+		/* report coalesced networks before the scan is completed */
+		wilc_scan_coalesce_kick(wilc, &hif_drv->scan_coalesce);
+
 		msg = wilc_alloc_work(vif, handle_scan_complete, false);
 		if (IS_ERR(msg))
 			return;
@@ -295,6 +295,33 @@ struct reg_frame {
 	u8 reg_id;
 };
 
+/*
+ * Network-info frames received during a scan are coalesced per BSSID for
+ * up to WILC_SCAN_COALESCE_MS, keeping the best-RSSI sample, and handed
+ * to the scan handler in one batch.
+ */
+#define WILC_SCAN_COALESCE_SLOTS	32
+#define WILC_SCAN_COALESCE_MS		20
+
+struct wilc_scan_coalesce_entry {
+	u8 bssid[ETH_ALEN];
+	s8 rssi;
+	u8 *buffer;
+	u32 len;
+	u32 size;
+};
+
+struct wilc_scan_coalescer {
+	/*protect ent and count*/
+	struct mutex lock;
+	struct wilc_scan_coalesce_entry ent[WILC_SCAN_COALESCE_SLOTS];
+	struct wilc_scan_coalesce_entry batch[WILC_SCAN_COALESCE_SLOTS];
+	int count;
+	u32 merged;
+	struct delayed_work flush_work;
+	struct wilc_vif *vif;
+};
+
 struct host_if_drv {
 	struct user_scan_req usr_scan_req;
 	struct user_conn_req usr_conn_req;
@@ -323,6 +350,7 @@ struct host_if_drv {
 	bool ifc_up;
 	int driver_handler_id;
 	u8 assoc_resp[MAX_ASSOC_RESP_FRAME_SIZE];
+	struct wilc_scan_coalescer scan_coalesce;
 };
 
 struct add_sta_param {
@@ -36,17 +36,11 @@ void wilc_wfi_handle_monitor_rx(struct wilc *wilc, u8 *buff, u32 size)
 	struct wilc_vif *vif = 0;
 	struct sk_buff *skb = NULL;
 	struct wfi_rtap_hdr *hdr;
-	int i;
-
-	for (i = 0; i <= wilc->vif_num; i++) {
-		if (wilc->vif[i]->iftype == MONITOR_MODE) {
-			vif = wilc->vif[i];
-			break;
-		}
-	}
 
+	vif = wilc_rx_demux_mon_vif(wilc);
 	if (!vif) {
-		PRINT_D(vif->ndev, HOSTAPD_DBG, "Monitor interface not up\n");
+		PRINT_D(wilc->vif[0]->ndev, HOSTAPD_DBG,
+			"Monitor interface not up\n");
 		return;
 	}
 
@@ -12,10 +12,16 @@
 #include <linux/etherdevice.h>
 #include <linux/interrupt.h>
 #include <net/ip.h>
+#include <net/ipv6.h>
+#include <linux/jhash.h>
 #include <linux/module.h>
 #ifdef DISABLE_PWRSAVE_AND_SCAN_DURING_IP
 #include <linux/inetdevice.h>
 #endif /* DISABLE_PWRSAVE_AND_SCAN_DURING_IP */
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
+#endif
 
 #include "linux_wlan.h"
 #include "wilc_wfi_cfgoperations.h"
@@ -580,6 +586,7 @@ void wilc_wlan_set_bssid(struct net_device *wilc_netdev, u8 *bssid, u8 mode)
 			wilc->vif[i]->iftype = mode;
 		}
 	}
+	wilc_rx_demux_update(wilc);
 }
 
 int wilc_wlan_get_num_conn_ifcs(struct wilc *wilc)
@@ -1070,6 +1077,7 @@ static void wlan_init_locks(struct net_device *dev)
 	init_completion(&wl->sync_event);
 	init_completion(&wl->txq_thread_started);
 	init_completion(&wl->debug_thread_started);
+	init_completion(&wl->tx_async_done);
 }
 
 static int wlan_initialize_threads(struct net_device *dev)
@@ -1328,6 +1336,7 @@ static int wilc_set_mac_addr(struct net_device *dev, void *p)
 	/* configure new MAC address */
 	result = wilc_set_mac_address(vif, (u8 *)addr->sa_data);
 	ether_addr_copy(vif->bssid, addr->sa_data);
+	wilc_rx_demux_update(wilc);
 	ether_addr_copy(vif->ndev->dev_addr, vif->bssid);
 
 	return result;
@@ -1521,11 +1530,265 @@ static int wilc_mac_close(struct net_device *ndev)
 	return 0;
 }
 
-void wilc_frmw_to_linux(struct wilc_vif *vif, u8 *buff, u32 size,
-			u32 pkt_offset, u8 status)
+#ifdef WILC_XDP
+static void wilc_xdp_tx_complete(void *priv, int status)
+{
+	struct tx_complete_data *pv_data = priv;
+
+	xdp_return_frame(pv_data->xdpf);
+	kfree(pv_data);
+}
+
+/*
+ * Queue an xdp_frame on the driver TX queue. On success the frame is owned
+ * by the TX path, which returns it once sent or dropped.
+ */
+static int wilc_xdp_xmit_frame(struct wilc_vif *vif, struct xdp_frame *xdpf)
+{
+	struct wilc *wilc = vif->wilc;
+	struct tx_complete_data *tx_data;
+
+	if (!wilc->initialized || wilc->quit)
+		return -ENETDOWN;
+
+	if (wilc->txq_entries > FLOW_CTRL_UP_THRESHLD)
+		return -EBUSY;
+
+	tx_data = kmalloc(sizeof(*tx_data), GFP_ATOMIC);
+	if (!tx_data)
+		return -ENOMEM;
+
+	tx_data->buff = xdpf->data;
+	tx_data->size = xdpf->len;
+	tx_data->skb = NULL;
+	tx_data->xdpf = xdpf;
+	tx_data->bssid = wilc->vif[vif->idx]->bssid;
+	tx_data->vif = vif;
+	vif->netstats.tx_packets++;
+	vif->netstats.tx_bytes += tx_data->size;
+	txq_add_net_pkt(vif->ndev, (void *)tx_data, tx_data->buff,
+			tx_data->size, wilc_xdp_tx_complete);
+
+	return 0;
+}
+
+static int wilc_xdp_xmit(struct net_device *ndev, int n,
+			 struct xdp_frame **frames, u32 flags)
+{
+	struct wilc_vif *vif = netdev_priv(ndev);
+	int i;
+
+	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+		return -EINVAL;
+
+	for (i = 0; i < n; i++)
+		if (wilc_xdp_xmit_frame(vif, frames[i]))
+			break;
+
+	return i;
+}
+
+static int wilc_xdp_setup(struct net_device *ndev, struct bpf_prog *prog,
+			  struct netlink_ext_ack *extack)
+{
+	struct wilc_vif *vif = netdev_priv(ndev);
+	struct bpf_prog *old_prog;
+
+	/* without rxq info the program would see xdp_buffs with no rxq */
+	if (prog && !xdp_rxq_info_is_reg(&vif->xdp_rxq)) {
+		NL_SET_ERR_MSG(extack, "XDP rxq info not registered");
+		return -EOPNOTSUPP;
+	}
+
+	old_prog = rcu_replace_pointer(vif->xdp_prog, prog,
+				       lockdep_rtnl_is_held());
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	PRINT_INFO(ndev, RX_DBG, "XDP program %s\n",
+		   prog ? "attached" : "detached");
+	return 0;
+}
+
+static int wilc_xdp(struct net_device *ndev, struct netdev_bpf *bpf)
+{
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		return wilc_xdp_setup(ndev, bpf->prog, bpf->extack);
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * The RX buffer is reused for the next chunk, so frames leaving the driver
+ * through XDP_TX or XDP_REDIRECT are copied into a page fragment first.
+ */
+static bool wilc_xdp_copy_buff(struct wilc_vif *vif, struct xdp_buff *src,
+			       struct xdp_buff *dst)
+{
+	u32 len = src->data_end - src->data;
+	unsigned int truesize;
+	void *hard_start;
+
+	truesize = SKB_DATA_ALIGN(XDP_PACKET_HEADROOM + len) +
+		   SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+	hard_start = netdev_alloc_frag(truesize);
+	if (!hard_start)
+		return false;
+
+	memcpy(hard_start + XDP_PACKET_HEADROOM, src->data, len);
+	xdp_init_buff(dst, truesize, &vif->xdp_rxq);
+	xdp_prepare_buff(dst, hard_start, XDP_PACKET_HEADROOM, len, false);
+
+	return true;
+}
+
+/*
+ * Run the attached XDP program directly on the frame in the RX buffer.
+ * The firmware header in front of the frame serves as headroom; the frame
+ * cannot grow at the tail since the next frame follows it. On XDP_PASS
+ * @buff, @size and @pkt_offset are updated to whatever the program left.
+ */
+static u32 wilc_run_xdp(struct wilc_vif *vif, u8 **buff, u32 *size,
+			u32 *pkt_offset)
+{
+	struct bpf_prog *prog;
+	struct xdp_buff xdp, copy;
+	struct xdp_frame *xdpf;
+	u32 act;
+
+	rcu_read_lock();
+	prog = rcu_dereference(vif->xdp_prog);
+	if (!prog) {
+		rcu_read_unlock();
+		return XDP_PASS;
+	}
+
+	local_bh_disable();
+	/* exactly the shared info the core reserves, so no tailroom is left */
+	xdp_init_buff(&xdp, *pkt_offset + *size +
+		      sizeof(struct skb_shared_info), &vif->xdp_rxq);
+	xdp_prepare_buff(&xdp, *buff - *pkt_offset, *pkt_offset, *size,
+			 false);
+
+	act = bpf_prog_run_xdp(prog, &xdp);
+	switch (act) {
+	case XDP_PASS:
+		*buff = xdp.data;
+		*size = xdp.data_end - xdp.data;
+		*pkt_offset = (u8 *)xdp.data - (u8 *)xdp.data_hard_start;
+		break;
+	case XDP_TX:
+		if (!wilc_xdp_copy_buff(vif, &xdp, &copy))
+			goto drop;
+		xdpf = xdp_convert_buff_to_frame(&copy);
+		if (!xdpf) {
+			page_frag_free(copy.data_hard_start);
+			goto drop;
+		}
+		if (wilc_xdp_xmit_frame(vif, xdpf)) {
+			xdp_return_frame(xdpf);
+			goto drop;
+		}
+		break;
+	case XDP_REDIRECT:
+		if (!wilc_xdp_copy_buff(vif, &xdp, &copy))
+			goto drop;
+		if (xdp_do_redirect(vif->ndev, &copy, prog)) {
+			page_frag_free(copy.data_hard_start);
+			goto drop;
+		}
+		xdp_do_flush();
+		break;
+	default:
+#if KERNEL_VERSION(5, 17, 0) <= LINUX_VERSION_CODE
+		bpf_warn_invalid_xdp_action(vif->ndev, prog, act);
+#else
+		bpf_warn_invalid_xdp_action(act);
+#endif
+		fallthrough;
+	case XDP_ABORTED:
+		trace_xdp_exception(vif->ndev, prog, act);
+		fallthrough;
+	case XDP_DROP:
+drop:
+		act = XDP_DROP;
+		vif->netstats.rx_dropped++;
+		break;
+	}
+	local_bh_enable();
+	rcu_read_unlock();
+
+	return act;
+}
+#endif /* WILC_XDP */
+
+/*
+ * Compute a flow hash from the IPv4/IPv6 addresses and TCP/UDP ports of a
+ * received ethernet frame while it is still in cache, so RPS/RFS do not
+ * have to dissect it again. Fragments and other protocols get an L3 hash.
+ */
+static void wilc_rx_set_hash(struct sk_buff *skb, const u8 *frame, u32 len)
+{
+	static u32 wilc_rx_hash_seed __read_mostly;
+	const struct ethhdr *eth = (const struct ethhdr *)frame;
+	enum pkt_hash_types type = PKT_HASH_TYPE_L3;
+	const u8 *l4 = NULL;
+	u32 saddr, daddr, ports = 0;
+	u8 proto;
+
+	if (len < ETH_HLEN)
+		return;
+
+	net_get_random_once(&wilc_rx_hash_seed, sizeof(wilc_rx_hash_seed));
+
+	frame += ETH_HLEN;
+	len -= ETH_HLEN;
+
+	if (eth->h_proto == htons(ETH_P_IP)) {
+		const struct iphdr *iph = (const struct iphdr *)frame;
+		u32 ihl;
+
+		if (len < sizeof(*iph))
+			return;
+		ihl = iph->ihl * 4;
+		if (ihl < sizeof(*iph) || len < ihl)
+			return;
+
+		saddr = (__force u32)iph->saddr;
+		daddr = (__force u32)iph->daddr;
+		proto = iph->protocol;
+		if (!ip_is_fragment(iph) && len >= ihl + 4)
+			l4 = frame + ihl;
+	} else if (eth->h_proto == htons(ETH_P_IPV6)) {
+		const struct ipv6hdr *ip6h = (const struct ipv6hdr *)frame;
+
+		if (len < sizeof(*ip6h))
+			return;
+
+		saddr = (__force u32)ipv6_addr_hash(&ip6h->saddr);
+		daddr = (__force u32)ipv6_addr_hash(&ip6h->daddr);
+		proto = ip6h->nexthdr;
+		if (len >= sizeof(*ip6h) + 4)
+			l4 = frame + sizeof(*ip6h);
+	} else {
+		return;
+	}
+
+	if (l4 && (proto == IPPROTO_TCP || proto == IPPROTO_UDP)) {
+		ports = get_unaligned((const u32 *)l4);
+		type = PKT_HASH_TYPE_L4;
+	}
+
+	skb_set_hash(skb, jhash_3words(saddr, daddr, ports,
+				       wilc_rx_hash_seed ^ proto), type);
+}
+
+static struct sk_buff *wilc_frmw_to_skb(struct wilc_vif *vif, u8 *buff,
+					 u32 size, u32 pkt_offset, u8 status)
 {
 	unsigned int frame_len = 0;
-	int stats;
 	unsigned char *buff_to_send = NULL;
 	struct sk_buff *skb;
 	struct wilc_priv *priv;
@@ -1537,9 +1800,15 @@ void wilc_frmw_to_linux(struct wilc_vif *vif, u8 *buff, u32 size,
 	if (size == 0) {
 		PRINT_ER(vif->ndev,
 			 "Discard sending packet with len = %d\n", size);
-		return;
+		return NULL;
 	}
 
+#ifdef WILC_XDP
+	if (status == PKT_STATUS_NEW &&
+	    wilc_run_xdp(vif, &buff, &size, &pkt_offset) != XDP_PASS)
+		return NULL;
+#endif
+
 	frame_len = size;
 	buff_to_send = buff;
 
@@ -1558,7 +1827,7 @@ void wilc_frmw_to_linux(struct wilc_vif *vif, u8 *buff, u32 size,
 			} else {
 				PRINT_ER(vif->ndev,
 					 "failed to alloc buffered_eap\n");
-				return;
+				return NULL;
 			}
 		} else {
 			kfree(priv->buffered_eap->buff);
@@ -1574,12 +1843,12 @@ void wilc_frmw_to_linux(struct wilc_vif *vif, u8 *buff, u32 size,
 	#endif
 		mod_timer(&priv->eap_buff_timer, (jiffies +
 			  msecs_to_jiffies(10)));
-		return;
+		return NULL;
 	}
 	skb = dev_alloc_skb(frame_len);
 	if (!skb) {
 		PRINT_ER(vif->ndev, "Low memory - packet droped\n");
-		return;
+		return NULL;
 	}
 
 	skb->dev = vif->ndev;
@@ -1591,25 +1860,75 @@ void wilc_frmw_to_linux(struct wilc_vif *vif, u8 *buff, u32 size,
 	memcpy(skb_put(skb, frame_len), buff_to_send, frame_len);
 #endif
 
+	wilc_rx_set_hash(skb, buff_to_send, frame_len);
 	skb->protocol = eth_type_trans(skb, vif->ndev);
 	vif->netstats.rx_packets++;
 	vif->netstats.rx_bytes += frame_len;
 	skb->ip_summed = CHECKSUM_UNNECESSARY;
+
+	return skb;
+}
+
+void wilc_frmw_to_linux(struct wilc_vif *vif, u8 *buff, u32 size,
+			u32 pkt_offset, u8 status)
+{
+	struct sk_buff *skb;
+	int stats;
+
+	skb = wilc_frmw_to_skb(vif, buff, size, pkt_offset, status);
+	if (!skb)
+		return;
+
 	stats = netif_rx(skb);
 	PRINT_D(vif->ndev, RX_DBG, "netif_rx ret value: %d\n", stats);
 }
 
+/*
+ * Queue a received data frame on @list instead of handing it to the stack
+ * right away, so that all frames of one RX chunk for the same interface
+ * can be delivered together by wilc_rx_list_deliver().
+ */
+void wilc_frmw_to_linux_list(struct wilc_vif *vif, u8 *buff, u32 size,
+			     u32 pkt_offset, struct sk_buff_head *list)
+{
+	struct sk_buff *skb;
+
+	skb = wilc_frmw_to_skb(vif, buff, size, pkt_offset, PKT_STATUS_NEW);
+	if (skb)
+		__skb_queue_tail(list, skb);
+}
+
+void wilc_rx_list_deliver(struct sk_buff_head *list)
+{
+	struct sk_buff *skb;
+
+	if (skb_queue_empty(list))
+		return;
+
+	local_bh_disable();
+#if KERNEL_VERSION(4, 19, 0) <= LINUX_VERSION_CODE
+	{
+		LIST_HEAD(rx_list);
+
+		while ((skb = __skb_dequeue(list)))
+			list_add_tail(&skb->list, &rx_list);
+		netif_receive_skb_list(&rx_list);
+	}
+#else
+	while ((skb = __skb_dequeue(list)))
+		netif_receive_skb(skb);
+#endif
+	local_bh_enable();
+}
+
 void wilc_wfi_mgmt_rx(struct wilc *wilc, u8 *buff, u32 size)
 {
-	int i = 0;
 	struct wilc_vif *vif;
 
-	for (i = 0; i <= wilc->vif_num; i++) {
-		vif = netdev_priv(wilc->vif[i]->ndev);
-		if (vif->monitor_flag) {
-			wilc_wfi_monitor_rx(vif, buff, size);
-			return;
-		}
+	vif = wilc_rx_demux_mgmt_vif(wilc);
+	if (vif) {
+		wilc_wfi_monitor_rx(vif, buff, size);
+		return;
 	}
 
 	vif = netdev_priv(wilc->vif[1]->ndev);
@@ -1642,6 +1961,10 @@ void wilc_netdev_cleanup(struct wilc *wilc)
 				   "Unregistering netdev %p\n",
 				   wilc->vif[i]->ndev);
 			unregister_netdev(wilc->vif[i]->ndev);
+#ifdef WILC_XDP
+			if (xdp_rxq_info_is_reg(&wilc->vif[i]->xdp_rxq))
+				xdp_rxq_info_unreg(&wilc->vif[i]->xdp_rxq);
+#endif
 			PRINT_INFO(wilc->vif[i]->ndev, INIT_DBG,
 				   "Freeing Wiphy...\n");
 			wilc_free_wiphy(wilc->vif[i]->ndev);
@@ -1654,9 +1977,12 @@ void wilc_netdev_cleanup(struct wilc *wilc)
 		unregister_inetaddr_notifier(&g_dev_notifier);
 	#endif
 
+	wilc_wlan_ctrl_rx_deinit(wilc);
 	flush_workqueue(wilc->hif_workqueue);
 	destroy_workqueue(wilc->hif_workqueue);
 	wilc->hif_workqueue = NULL;
+	wilc_bus_arb_deinit(wilc);
+	wilc_autosleep_deinit(wilc);
 	cfg_deinit(wilc);
 	kfree(wilc->bus_data);
 	kfree(wilc);
@@ -1673,6 +1999,10 @@ static const struct net_device_ops wilc_netdev_ops = {
 	.ndo_start_xmit = wilc_mac_xmit,
 	.ndo_get_stats = mac_stats,
 	.ndo_set_rx_mode  = wilc_set_multicast_list,
+#ifdef WILC_XDP
+	.ndo_bpf = wilc_xdp,
+	.ndo_xdp_xmit = wilc_xdp_xmit,
+#endif
 };
 
 int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
@@ -1696,10 +2026,16 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 	*wilc = wl;
 	wl->io_type = io_type;
 	wl->hif_func = ops;
+	/* matches the zeroed wl->chip until the bus reads the chip id */
+	wl->chip_ops = &wilc1000_ops;
+	wilc_reg_shadow_init(wl);
+	wilc_autosleep_init(wl);
+	wilc_bus_arb_init(wl);
 	for (i = 0; i < NQUEUES; i++)
 		INIT_LIST_HEAD(&wl->txq[i].txq_head.list);
 
 	INIT_LIST_HEAD(&wl->rxq_head.list);
+	seqlock_init(&wl->rx_demux_lock);
 
 	wl->hif_workqueue = create_singlethread_workqueue("WILC_wq");
 	if (!wl->hif_workqueue) {
@@ -1707,6 +2043,10 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 		goto free_cfg;
 	}
 
+	ret = wilc_wlan_ctrl_rx_init(wl);
+	if (ret)
+		goto free_hif_wq;
+
 #ifdef DISABLE_PWRSAVE_AND_SCAN_DURING_IP
 	register_inetaddr_notifier(&g_dev_notifier);
 #endif
@@ -1734,6 +2074,11 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 
 
 		ndev->netdev_ops = &wilc_netdev_ops;
+#if KERNEL_VERSION(6, 3, 0) <= LINUX_VERSION_CODE
+		ndev->xdp_features = NETDEV_XDP_ACT_BASIC |
+				     NETDEV_XDP_ACT_REDIRECT |
+				     NETDEV_XDP_ACT_NDO_XMIT;
+#endif
 
 		wdev = wilc_create_wiphy(ndev, dev);
 		if (!wdev) {
@@ -1759,9 +2104,21 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 			goto free_ndev;
 		}
 
+#ifdef WILC_XDP
+		if (xdp_rxq_info_reg(&vif->xdp_rxq, ndev, 0, 0)) {
+			PRINT_WRN(ndev, INIT_DBG, "XDP rxq info not registered\n");
+		} else if (xdp_rxq_info_reg_mem_model(&vif->xdp_rxq,
+						      MEM_TYPE_PAGE_SHARED,
+						      NULL)) {
+			PRINT_WRN(ndev, INIT_DBG, "XDP rxq info not registered\n");
+			xdp_rxq_info_unreg(&vif->xdp_rxq);
+		}
+#endif
+
 		vif->iftype = STATION_MODE;
 		vif->mac_opened = 0;
 	}
+	wilc_rx_demux_update(wl);
 	wilc_sysfs_init(wl->vif[0], wl->vif[1]);
 
 	return 0;
@@ -1778,8 +2135,12 @@ free_ndev:
 		}
 	}
 	unregister_inetaddr_notifier(&g_dev_notifier);
+	wilc_wlan_ctrl_rx_deinit(wl);
+free_hif_wq:
 	destroy_workqueue(wl->hif_workqueue);
 free_cfg:
+	wilc_bus_arb_deinit(wl);
+	wilc_autosleep_deinit(wl);
 	cfg_deinit(wl);
 free_wl:
 	kfree(wl);
@@ -1882,11 +2243,14 @@ void wilc_wlan_power_on_sequence(struct wilc *wilc)
 {
 	wilc_wlan_power(wilc, 0);
 	wilc_wlan_power(wilc, 1);
+	wilc_reg_shadow_invalidate(wilc);
 }
 
 void wilc_wlan_power_off_sequence(struct wilc *wilc)
 {
+	wilc_autosleep_flush(wilc);
 	wilc_wlan_power(wilc, 0);
+	wilc_reg_shadow_invalidate(wilc);
 }
 
 MODULE_LICENSE("GPL");
@@ -24,6 +24,10 @@ static ssize_t wilc_sysfs_show(struct kobject *kobj,
 		attr_val = vif[0]->attr_sysfs.antenna1;
 	else if (strcmp(attr->attr.name, "antenna2") == 0)
 		attr_val = vif[0]->attr_sysfs.antenna2;
+	else if (strcmp(attr->attr.name, "autosleep_ms") == 0)
+		attr_val = vif[0]->wilc->sleep_idle_ms;
+	else if (strcmp(attr->attr.name, "autosleep_max_ms") == 0)
+		attr_val = vif[0]->wilc->sleep_idle_max_ms;
 
 	return sprintf(buf, "%d\n", attr_val);
 }
@@ -35,6 +39,18 @@ static ssize_t wilc_sysfs_store(struct kobject *kobj,
 	int attr_val;
 	int i;
 
+	/* per device, not per interface */
+	if (strcmp(attr->attr.name, "autosleep_ms") == 0 ||
+	    strcmp(attr->attr.name, "autosleep_max_ms") == 0) {
+		if (kstrtoint(buf, 10, &attr_val) || attr_val < 0)
+			return -EINVAL;
+		if (strcmp(attr->attr.name, "autosleep_ms") == 0)
+			wilc_autosleep_set(vif[0]->wilc, attr_val, -1);
+		else
+			wilc_autosleep_set(vif[0]->wilc, -1, attr_val);
+		return count;
+	}
+
 	for (i = 0; i < NUM_CONCURRENT_IFC; i++) {
 		if (kstrtoint(buf, 10, &attr_val))
 			PRINT_ER(vif[i]->ndev,
@@ -69,12 +85,20 @@ static struct kobj_attribute ant_swtch_antenna1_attr =
 static struct kobj_attribute ant_swtch_antenna2_attr =
 	__ATTR(antenna2, 0664, wilc_sysfs_show, wilc_sysfs_store);
 
+static struct kobj_attribute autosleep_attr =
+	__ATTR(autosleep_ms, 0664, wilc_sysfs_show, wilc_sysfs_store);
+
+static struct kobj_attribute autosleep_max_attr =
+	__ATTR(autosleep_max_ms, 0664, wilc_sysfs_show, wilc_sysfs_store);
+
 
 static struct attribute *wilc_attrs[] = {
 	&p2p_mode_attr.attr,
 	&ant_swtch_mode_attr.attr,
 	&ant_swtch_antenna1_attr.attr,
 	&ant_swtch_antenna2_attr.attr,
+	&autosleep_attr.attr,
+	&autosleep_max_attr.attr,
 	NULL
 };
 
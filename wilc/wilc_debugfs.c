@@ -103,6 +103,11 @@ int wilc_debugfs_init(void)
 	return 0;
 }
 
+struct dentry *wilc_debugfs_get_dir(void)
+{
+	return wilc_dir;
+}
+
 void wilc_debugfs_remove(void)
 {
 	debugfs_remove_recursive(wilc_dir);
@@ -45,6 +45,9 @@ extern atomic_t WILC_DEBUG_REGION;
 #define PRINT_ER(netdev, format, ...) netdev_err(netdev, "ERR [%s:%d] "format,\
 	__func__, __LINE__, ##__VA_ARGS__)
 
+struct dentry;
+
 int wilc_debugfs_init(void);
+struct dentry *wilc_debugfs_get_dir(void);
 void wilc_debugfs_remove(void);
 #endif /* WILC_DEBUGFS_H */
@@ -7,6 +7,9 @@
 #include <linux/mmc/sdio_func.h>
 #include <linux/mmc/host.h>
 #include <linux/mmc/card.h>
+#include <linux/mmc/core.h>
+#include <linux/mmc/sdio.h>
+#include <linux/scatterlist.h>
 #include <linux/module.h>
 #include <linux/pm_runtime.h>
 
@@ -34,11 +37,38 @@ static const struct sdio_device_id wilc_sdio_ids[] = {
 
 #define WILC_SDIO_BLOCK_SIZE 512
 
+static bool csa_cache;
+module_param(csa_cache, bool, 0644);
+MODULE_PARM_DESC(csa_cache,
+		 "Only reprogram the CSA address bytes that changed (experimental)");
+
+static bool block_pad;
+module_param(block_pad, bool, 0444);
+MODULE_PARM_DESC(block_pad,
+		 "Pad TX/RX data transfers to whole SDIO blocks so each is a single block-mode CMD53");
+
+/* consecutive registers moved by one CMD53 in a hif_batch */
+#define WILC_SDIO_BATCH_MAX	16
+
+/* segments of a scatter-gather CMD53 */
+#define WILC_SDIO_MAX_SEGS	16
+
 struct wilc_sdio {
 	bool irq_gpio;
 	u32 block_size;
 	int nint;
 	bool is_init;
+	/* DMA-safe bounce buffer for batched register runs and status reads */
+	__le32 *batch_buf;
+	/* read the RX size with two CMD52s instead of one CMD53 */
+	bool size_cmd52;
+	/* task holding the MMC host across a bus session */
+	struct task_struct *claimer;
+	/* last address programmed into the CSA pointer */
+	u32 csa_addr;
+	bool csa_valid;
+	/* sg list of the block CMD53 in flight, under hif_cs */
+	struct scatterlist sg[WILC_SDIO_MAX_SEGS];
 };
 
 static const struct wilc_hif_func wilc_hif_sdio;
@@ -52,6 +82,10 @@ static void wilc_sdio_interrupt(struct sdio_func *func)
 	if (sdio_intr_lock == WILC_SDIO_HOST_DIS_TAKEN)
 		return;
 	sdio_intr_lock = WILC_SDIO_HOST_IRQ_TAKEN;
+	/*
+	 * The handler claims the host again for its bus session, under
+	 * hif_cs; keeping it claimed here would invert that lock order.
+	 */
 	sdio_release_host(func);
 	wilc_handle_isr(sdio_get_drvdata(func));
 	sdio_claim_host(func);
@@ -59,13 +93,53 @@ static void wilc_sdio_interrupt(struct sdio_func *func)
 	wake_up_interruptible(&sdio_intr_waitqueue);
 }
 
+/*
+ * Keep the MMC host claimed for a whole acquire_bus()/release_bus() window,
+ * so the commands in it don't each claim and release it. The claim belongs
+ * to the task holding hif_cs; anyone else still claims per command.
+ */
+static void wilc_sdio_claim_bus(struct wilc *wilc)
+{
+	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+
+	sdio_claim_host(func);
+	sdio_priv->claimer = current;
+}
+
+static void wilc_sdio_release_bus(struct wilc *wilc)
+{
+	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+
+	sdio_priv->claimer = NULL;
+	sdio_release_host(func);
+}
+
+static bool wilc_sdio_claimed(struct wilc *wilc)
+{
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+
+	return sdio_priv->claimer == current;
+}
+
+/* the CSA pointer may no longer hold what we last wrote */
+static void sdio_csa_invalidate(struct wilc *wilc)
+{
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+
+	sdio_priv->csa_valid = false;
+}
+
 static int wilc_sdio_cmd52(struct wilc *wilc, struct sdio_cmd52 *cmd)
 {
 	struct sdio_func *func = container_of(wilc->dev, struct sdio_func, dev);
+	bool claim = !wilc_sdio_claimed(wilc);
 	int ret;
 	u8 data;
 
-	sdio_claim_host(func);
+	if (claim)
+		sdio_claim_host(func);
 
 	func->num = cmd->function;
 	if (cmd->read_write) {  /* write */
@@ -81,7 +155,8 @@ static int wilc_sdio_cmd52(struct wilc *wilc, struct sdio_cmd52 *cmd)
 		cmd->data = data;
 	}
 
-	sdio_release_host(func);
+	if (claim)
+		sdio_release_host(func);
 
 	if (ret)
 		dev_err(&func->dev, "%s..failed, err(%d)\n", __func__, ret);
@@ -91,9 +166,11 @@ static int wilc_sdio_cmd52(struct wilc *wilc, struct sdio_cmd52 *cmd)
 static int wilc_sdio_cmd53(struct wilc *wilc, struct sdio_cmd53 *cmd)
 {
 	struct sdio_func *func = container_of(wilc->dev, struct sdio_func, dev);
+	bool claim = !wilc_sdio_claimed(wilc);
 	int size, ret;
 
-	sdio_claim_host(func);
+	if (claim)
+		sdio_claim_host(func);
 
 	func->num = cmd->function;
 	func->cur_blksize = cmd->block_size;
@@ -110,10 +187,70 @@ static int wilc_sdio_cmd53(struct wilc *wilc, struct sdio_cmd53 *cmd)
 					 cmd->address,  size);
 	}
 
-	sdio_release_host(func);
+	if (claim)
+		sdio_release_host(func);
 
-	if (ret)
+	if (ret) {
 		dev_err(&func->dev, "%s..failed, err(%d)\n", __func__,  ret);
+		sdio_csa_invalidate(wilc);
+	}
+
+	return ret;
+}
+
+/*
+ * Issue a CMD53 straight from an sg list with our own mmc_request, so the
+ * data moves in a single request that the host can DMA from every segment
+ * without a bounce copy. Block counts must fit the host limits.
+ */
+static int wilc_sdio_cmd53_sg(struct wilc *wilc, struct sdio_cmd53 *cmd,
+			      struct scatterlist *sg, unsigned int nents)
+{
+	struct sdio_func *func = container_of(wilc->dev, struct sdio_func, dev);
+	struct mmc_request mrq = {};
+	struct mmc_command cmd53 = {};
+	struct mmc_data data = {};
+	bool claim = !wilc_sdio_claimed(wilc);
+	int ret = 0;
+
+	cmd53.opcode = SD_IO_RW_EXTENDED;
+	cmd53.arg = cmd->read_write ? 0x80000000 : 0;
+	cmd53.arg |= cmd->function << 28;
+	cmd53.arg |= cmd->block_mode ? 0x08000000 : 0;
+	cmd53.arg |= cmd->increment ? 0x04000000 : 0;
+	cmd53.arg |= cmd->address << 9;
+	cmd53.arg |= cmd->count;
+	cmd53.flags = MMC_RSP_SPI_R5 | MMC_RSP_R5 | MMC_CMD_ADTC;
+
+	data.blksz = cmd->block_mode ? cmd->block_size : cmd->count;
+	data.blocks = cmd->block_mode ? cmd->count : 1;
+	data.flags = cmd->read_write ? MMC_DATA_WRITE : MMC_DATA_READ;
+	data.sg = sg;
+	data.sg_len = nents;
+
+	mrq.cmd = &cmd53;
+	mrq.data = &data;
+
+	if (claim)
+		sdio_claim_host(func);
+	mmc_set_data_timeout(&data, func->card);
+	mmc_wait_for_req(func->card->host, &mrq);
+	if (claim)
+		sdio_release_host(func);
+
+	if (cmd53.error)
+		ret = cmd53.error;
+	else if (data.error)
+		ret = data.error;
+	else if (!mmc_host_is_spi(func->card->host) &&
+		 (cmd53.resp[0] & (R5_ERROR | R5_FUNCTION_NUMBER |
+				   R5_OUT_OF_RANGE)))
+		ret = -EIO;
+
+	if (ret) {
+		dev_err(&func->dev, "%s..failed, err(%d)\n", __func__, ret);
+		sdio_csa_invalidate(wilc);
+	}
 
 	return ret;
 }
@@ -130,6 +267,14 @@ static int linux_sdio_probe(struct sdio_func *func,
 	if (!sdio_priv)
 		return -ENOMEM;
 
+	sdio_priv->batch_buf = kmalloc_array(WILC_SDIO_BATCH_MAX,
+					     sizeof(*sdio_priv->batch_buf),
+					     GFP_KERNEL);
+	if (!sdio_priv->batch_buf) {
+		kfree(sdio_priv);
+		return -ENOMEM;
+	}
+
 	if (IS_ENABLED(CONFIG_WILC_HW_OOB_INTR))
 		io_type = HIF_SDIO_GPIO_IRQ;
 	else
@@ -138,6 +283,7 @@ static int linux_sdio_probe(struct sdio_func *func,
 	ret = wilc_netdev_init(&wilc, &func->dev, io_type, &wilc_hif_sdio);
 	if (ret) {
 		dev_err(&func->dev, "Couldn't initialize netdev\n");
+		kfree(sdio_priv->batch_buf);
 		kfree(sdio_priv);
 		return ret;
 	}
@@ -163,8 +309,12 @@ static int linux_sdio_probe(struct sdio_func *func,
 static void linux_sdio_remove(struct sdio_func *func)
 {
 	struct wilc *wilc = sdio_get_drvdata(func);
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+	__le32 *batch_buf = sdio_priv->batch_buf;
 
+	/* cleanup still talks to the chip and frees bus_data */
 	wilc_netdev_cleanup(wilc);
+	kfree(batch_buf);
 	wilc_bt_deinit();
 }
 
@@ -175,6 +325,7 @@ static int wilc_sdio_reset(struct wilc *wilc)
 	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
 
 	dev_info(&func->dev, "De Init SDIO\n");
+	sdio_csa_invalidate(wilc);
 
 	cmd.read_write = 1;
 	cmd.function = 0;
@@ -201,6 +352,7 @@ static int wilc_sdio_suspend(struct device *dev)
 	int ret;
 
 	dev_info(&func->dev, "sdio suspend\n");
+	wilc_autosleep_flush(wilc);
 	mutex_lock(&wilc->hif_cs);
 
 	chip_wakeup(wilc, 0);
@@ -224,6 +376,9 @@ static int wilc_sdio_resume(struct device *dev)
 	struct wilc *wilc = sdio_get_drvdata(func);
 
 	dev_info(&func->dev, "sdio resume\n");
+	sdio_csa_invalidate(wilc);
+	/* the chip may have lost power while suspended */
+	wilc_reg_shadow_invalidate(wilc);
 	chip_wakeup(wilc, 0);
 	sdio_init(wilc, true);
 
@@ -316,8 +471,19 @@ static void wilc_sdio_disable_interrupt(struct wilc *dev)
 static int sdio_set_func0_csa_address(struct wilc *wilc, u32 adr)
 {
 	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
 	struct sdio_cmd52 cmd;
-	int ret;
+	u32 old;
+	int i, ret;
+
+	/*
+	 * With csa_cache only the bytes that differ from the last programmed
+	 * address go out. That relies on the CSA pointer itself not moving
+	 * when the window auto-increments, which is unconfirmed on hardware,
+	 * hence opt-in.
+	 */
+	old = sdio_priv->csa_valid && csa_cache ? sdio_priv->csa_addr : ~adr;
+	sdio_priv->csa_valid = false;
 
 	/**
 	 *      Review: BIG ENDIAN
@@ -325,33 +491,80 @@ static int sdio_set_func0_csa_address(struct wilc *wilc, u32 adr)
 	cmd.read_write = 1;
 	cmd.function = 0;
 	cmd.raw = 0;
-	cmd.address = 0x10c;
-	cmd.data = (u8)adr;
-	ret = wilc_sdio_cmd52(wilc, &cmd);
-	if (ret) {
-		dev_err(&func->dev, "Failed cmd52, set 0x10c data...\n");
-		goto fail;
+	for (i = 0; i < 3; i++) {
+		if ((u8)(adr >> (8 * i)) == (u8)(old >> (8 * i)))
+			continue;
+
+		cmd.address = 0x10c + i;
+		cmd.data = (u8)(adr >> (8 * i));
+		ret = wilc_sdio_cmd52(wilc, &cmd);
+		if (ret) {
+			dev_err(&func->dev, "Failed cmd52, set 0x%x data...\n",
+				cmd.address);
+			return 0;
+		}
 	}
 
-	cmd.address = 0x10d;
-	cmd.data = (u8)(adr >> 8);
-	ret = wilc_sdio_cmd52(wilc, &cmd);
-	if (ret) {
-		dev_err(&func->dev, "Failed cmd52, set 0x10d data...\n");
-		goto fail;
+	sdio_priv->csa_addr = adr;
+	sdio_priv->csa_valid = true;
+	return 1;
+}
+
+/*
+ * Burst access to @n consecutive registers from @addr: one CSA setup and
+ * one CMD53 through the auto-incrementing window, instead of one of each
+ * per register. @n is at most WILC_SDIO_BATCH_MAX.
+ */
+static int sdio_burst(struct wilc *wilc, u32 addr, u32 *vals, int n,
+		      bool write)
+{
+	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+	__le32 *buf = sdio_priv->batch_buf;
+	struct sdio_cmd53 cmd;
+	int i, ret;
+
+	if (!sdio_set_func0_csa_address(wilc, addr))
+		return 0;
+
+	cmd.read_write = write;
+	cmd.function = 0;
+	cmd.address = 0x10f;
+	cmd.block_mode = 0;
+	cmd.increment = 1;
+	cmd.count = n * 4;
+	cmd.buffer = (u8 *)buf;
+	cmd.block_size = sdio_priv->block_size;
+
+	if (write) {
+		for (i = 0; i < n; i++)
+			buf[i] = cpu_to_le32(vals[i]);
 	}
 
-	cmd.address = 0x10e;
-	cmd.data = (u8)(adr >> 16);
-	ret = wilc_sdio_cmd52(wilc, &cmd);
+	ret = wilc_sdio_cmd53(wilc, &cmd);
 	if (ret) {
-		dev_err(&func->dev, "Failed cmd52, set 0x10e data...\n");
-		goto fail;
+		dev_err(&func->dev, "Failed cmd53, burst of %d regs (%08x)...\n",
+			n, addr);
+		return 0;
+	}
+
+	if (!write) {
+		for (i = 0; i < n; i++)
+			vals[i] = le32_to_cpu(buf[i]);
 	}
 
 	return 1;
-fail:
-	return 0;
+}
+
+static int sdio_read_burst(struct wilc *wilc, u32 addr, u32 *vals, int n)
+{
+	return sdio_burst(wilc, addr, vals, n, false);
+}
+
+static int sdio_write_burst(struct wilc *wilc, u32 addr, const u32 *vals,
+			    int n)
+{
+	return sdio_burst(wilc, addr, (u32 *)vals, n, true);
 }
 
 static int sdio_set_func0_block_size(struct wilc *wilc, u32 block_size)
@@ -419,6 +632,83 @@ fail:
 	return 0;
 }
 
+/*
+ * Describe @size bytes at @buf in sdio_priv->sg, cut at the host segment
+ * size. Returns the number of entries, or 0 if the buffer can't be mapped
+ * this way and has to go through sdio_memcpy_toio/fromio.
+ */
+static unsigned int sdio_buf_to_sg(struct wilc *wilc, u8 *buf, u32 size)
+{
+	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+	struct mmc_host *host = func->card->host;
+	unsigned int nents = 0;
+	u32 seg;
+
+	if (!virt_addr_valid(buf))
+		return 0;
+
+	sg_init_table(sdio_priv->sg, WILC_SDIO_MAX_SEGS);
+	while (size) {
+		if (nents == min_t(unsigned int, host->max_segs,
+				   WILC_SDIO_MAX_SEGS))
+			return 0;
+		seg = min_t(u32, size, host->max_seg_size);
+		sg_set_buf(&sdio_priv->sg[nents++], buf, seg);
+		buf += seg;
+		size -= seg;
+	}
+	sg_mark_end(&sdio_priv->sg[nents - 1]);
+
+	return nents;
+}
+
+/*
+ * Move the block part of a block transfer, as few CMD53s as the host
+ * request limits allow, each from an sg list over the caller's buffer.
+ * @addr is the AHB address for function 0 accesses, 0 for function 1.
+ */
+static int wilc_sdio_cmd53_blocks(struct wilc *wilc, struct sdio_cmd53 *cmd,
+				  u32 addr)
+{
+	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+	struct mmc_host *host = func->card->host;
+	u32 nblk = cmd->count, max_blk, n;
+	unsigned int nents;
+	u8 *buf = cmd->buffer;
+	int ret;
+
+	max_blk = min3(host->max_blk_count, 511u,
+		       host->max_req_size / cmd->block_size);
+	if (!max_blk)
+		max_blk = 1;
+
+	while (nblk) {
+		n = min(nblk, max_blk);
+		if (addr > 0 && !sdio_set_func0_csa_address(wilc, addr))
+			return -EIO;
+
+		cmd->count = n;
+		cmd->buffer = buf;
+		nents = sdio_buf_to_sg(wilc, buf, n * cmd->block_size);
+		if (nents)
+			ret = wilc_sdio_cmd53_sg(wilc, cmd, sdio_priv->sg,
+						 nents);
+		else
+			ret = wilc_sdio_cmd53(wilc, cmd);
+		if (ret)
+			return ret;
+
+		if (addr > 0)
+			addr += n * cmd->block_size;
+		buf += n * cmd->block_size;
+		nblk -= n;
+	}
+
+	return 0;
+}
+
 /********************************************
  *
  *      Sdio interfaces
@@ -526,11 +816,7 @@ static int sdio_write(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
 		cmd.count = nblk;
 		cmd.buffer = buf;
 		cmd.block_size = block_size;
-		if (addr > 0) {
-			if (!sdio_set_func0_csa_address(wilc, addr))
-				goto fail;
-		}
-		ret = wilc_sdio_cmd53(wilc, &cmd);
+		ret = wilc_sdio_cmd53_blocks(wilc, &cmd, addr);
 		if (ret) {
 			dev_err(&func->dev,
 				"Failed cmd53 [%x], block send...\n", addr);
@@ -668,11 +954,7 @@ static int sdio_read(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
 		cmd.count = nblk;
 		cmd.buffer = buf;
 		cmd.block_size = block_size;
-		if (addr > 0) {
-			if (!sdio_set_func0_csa_address(wilc, addr))
-				goto fail;
-		}
-		ret = wilc_sdio_cmd53(wilc, &cmd);
+		ret = wilc_sdio_cmd53_blocks(wilc, &cmd, addr);
 		if (ret) {
 			dev_err(&func->dev,
 				"Failed cmd53 [%x], block read...\n", addr);
@@ -741,6 +1023,9 @@ static int sdio_init(struct wilc *wilc, bool resume)
 
 	init_waitqueue_head(&sdio_intr_waitqueue);
 	sdio_priv->irq_gpio = (wilc->io_type == HIF_SDIO_GPIO_IRQ);
+	sdio_csa_invalidate(wilc);
+	/* the host may have changed across a suspend, probe it again */
+	sdio_priv->size_cmd52 = false;
 
 	/**
 	 *      function 0 csa enable
@@ -764,6 +1049,7 @@ static int sdio_init(struct wilc *wilc, bool resume)
 		goto fail;
 	}
 	sdio_priv->block_size = WILC_SDIO_BLOCK_SIZE;
+	wilc->block_pad = block_pad ? WILC_SDIO_BLOCK_SIZE : 0;
 
 	/**
 	 *      enable func1 IO
@@ -832,11 +1118,7 @@ static int sdio_init(struct wilc *wilc, bool resume)
 	 **/
 	if (!resume) {
 		chipid = wilc_get_chipid(wilc, true);
-		if (is_wilc3000(chipid)) {
-			wilc->chip = WILC_3000;
-		} else if (is_wilc1000(chipid)) {
-			wilc->chip = WILC_1000;
-		} else {
+		if (wilc_chip_select(wilc, chipid)) {
 			dev_err(&func->dev, "Unsupported chipid: %x\n", chipid);
 			goto fail;
 		}
@@ -854,12 +1136,38 @@ fail:
 
 static int sdio_read_size(struct wilc *wilc, u32 *size)
 {
+	struct wilc_sdio *sdio_priv = wilc->bus_data;
+	u8 *buf = (u8 *)sdio_priv->batch_buf;
+	struct sdio_cmd53 cmd53;
 	u32 tmp;
 	struct sdio_cmd52 cmd;
+	int ret;
 
 	/**
-	 *      Read DMA count in words
+	 *      Read DMA count in words, 0xf2 and 0xf3 with a single CMD53
 	 **/
+	if (!sdio_priv->size_cmd52) {
+		cmd53.read_write = 0;
+		cmd53.function = 0;
+		cmd53.address = 0xf2;
+		cmd53.block_mode = 0;
+		cmd53.increment = 1;
+		cmd53.count = 2;
+		cmd53.buffer = buf;
+		cmd53.block_size = sdio_priv->block_size;
+		ret = wilc_sdio_cmd53(wilc, &cmd53);
+		if (!ret) {
+			*size = buf[0] | (buf[1] << 8);
+			return 1;
+		}
+		/*
+		 * the host can't do byte CMD53s to function 0, stop trying;
+		 * any other error is taken as transient
+		 */
+		if (ret == -EINVAL || ret == -ENOTSUPP)
+			sdio_priv->size_cmd52 = true;
+	}
+
 	cmd.read_write = 0;
 	cmd.function = 0;
 	cmd.raw = 0;
@@ -893,15 +1201,9 @@ static int sdio_read_int(struct wilc *wilc, u32 *int_status)
 		cmd.function = 1;
 		cmd.raw = 0;
 		cmd.data = 0;
-		if (wilc->chip == WILC_1000) {
-			cmd.address = 0xf7;
-			wilc_sdio_cmd52(wilc, &cmd);
-			irq_flags = cmd.data & 0x1f;
-		} else {
-			cmd.address = 0xfe;
-			wilc_sdio_cmd52(wilc, &cmd);
-			irq_flags = cmd.data & 0x0f;
-		}
+		cmd.address = wilc->chip_ops->sdio_irq_flags_reg;
+		wilc_sdio_cmd52(wilc, &cmd);
+		irq_flags = cmd.data & wilc->chip_ops->sdio_irq_flags_mask;
 		tmp |= ((irq_flags >> 0) << IRG_FLAGS_OFFSET);
 
 		*int_status = tmp;
@@ -944,100 +1246,125 @@ static int sdio_clear_int_ext(struct wilc *wilc, u32 val)
 {
 	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
 	struct wilc_sdio *sdio_priv = wilc->bus_data;
-	int ret;
+	const struct wilc_chip_ops *ops = wilc->chip_ops;
+	struct sdio_cmd52 cmd;
 	u32 reg = 0;
+	int ret;
 
-	if (wilc->chip == WILC_1000) {
-		if (sdio_priv->irq_gpio)
-			reg = val & (BIT(MAX_NUM_INT) - 1);
-
-		/* select VMM table 0 */
-		if (val & SEL_VMM_TBL0)
-			reg |= BIT(5);
-		/* select VMM table 1 */
-		if (val & SEL_VMM_TBL1)
-			reg |= BIT(6);
-		/* enable VMM */
-		if (val & EN_VMM)
-			reg |= BIT(7);
-		if (reg) {
-			struct sdio_cmd52 cmd;
-
-			cmd.read_write = 1;
-			cmd.function = 0;
-			cmd.raw = 0;
-			cmd.address = 0xf8;
-			cmd.data = reg;
-
-			ret = wilc_sdio_cmd52(wilc, &cmd);
-			if (ret) {
-				dev_err(&func->dev,
-					"Failed cmd52, set 0xf8 data (%d) ...\n",
-					__LINE__);
-				goto fail;
-			}
-		}
-	} else {
-		if (sdio_priv->irq_gpio) {
-			reg = val & (BIT(MAX_NUM_INT) - 1);
-			if (reg) {
-				struct sdio_cmd52 cmd;
-
-				cmd.read_write = 1;
-				cmd.function = 0;
-				cmd.raw = 0;
-				cmd.address = 0xfe;
-				cmd.data = reg;
-
-				ret = wilc_sdio_cmd52(wilc, &cmd);
-				if (ret) {
-					dev_err(&func->dev,
-						"Failed cmd52, set 0xf8 data (%d) ...\n",
-						__LINE__);
-					goto fail;
-				}
-			}
+	cmd.read_write = 1;
+	cmd.function = 0;
+	cmd.raw = 0;
+
+	if (sdio_priv->irq_gpio)
+		reg = val & (BIT(MAX_NUM_INT) - 1);
+
+	/* WILC3000 clears the flags on their own before the VMM bits */
+	if (reg && ops->sdio_irq_clear_reg != ops->sdio_vmm_reg) {
+		cmd.address = ops->sdio_irq_clear_reg;
+		cmd.data = reg;
+
+		ret = wilc_sdio_cmd52(wilc, &cmd);
+		if (ret) {
+			dev_err(&func->dev,
+				"Failed cmd52, set 0x%02x data (%d) ...\n",
+				cmd.address, __LINE__);
+			return 0;
 		}
-		/* select VMM table 0 */
-		if (val & SEL_VMM_TBL0)
-			reg |= BIT(0);
-		/* select VMM table 1 */
-		if (val & SEL_VMM_TBL1)
-			reg |= BIT(1);
-		/* enable VMM */
-		if (val & EN_VMM)
-			reg |= BIT(2);
-
-		if (reg) {
-			struct sdio_cmd52 cmd;
-
-			cmd.read_write = 1;
-			cmd.function = 0;
-			cmd.raw = 0;
-			cmd.address = 0xf1;
-			cmd.data = reg;
-
-			ret = wilc_sdio_cmd52(wilc, &cmd);
-			if (ret) {
-				dev_err(&func->dev,
-					"Failed cmd52, set 0xf6 data (%d) ...\n",
-					__LINE__);
-				goto fail;
-			}
+	}
+
+	/* select VMM table 0 */
+	if (val & SEL_VMM_TBL0)
+		reg |= BIT(0) << ops->sdio_vmm_shift;
+	/* select VMM table 1 */
+	if (val & SEL_VMM_TBL1)
+		reg |= BIT(1) << ops->sdio_vmm_shift;
+	/* enable VMM */
+	if (val & EN_VMM)
+		reg |= BIT(2) << ops->sdio_vmm_shift;
+	if (!reg)
+		return 1;
+
+	cmd.address = ops->sdio_vmm_reg;
+	cmd.data = reg;
+
+	ret = wilc_sdio_cmd52(wilc, &cmd);
+	if (ret) {
+		dev_err(&func->dev, "Failed cmd52, set 0x%02x data (%d) ...\n",
+			cmd.address, __LINE__);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Length of the run of plain reads or writes at @ops whose addresses follow
+ * each other, which one CMD53 can move
+ */
+static int sdio_batch_run(struct wilc_reg_op *ops, int n)
+{
+	int i;
+
+	if (ops[0].type == WILC_REG_OP_RMW ||
+	    (ops[0].addr >= 0xf0 && ops[0].addr <= 0xff))
+		return 1;
+
+	for (i = 1; i < n && i < WILC_SDIO_BATCH_MAX; i++) {
+		if (ops[i].type != ops[0].type ||
+		    ops[i].addr != ops[0].addr + 4 * i)
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * Run a register batch, moving runs of consecutive registers as one burst.
+ * Everything else goes through the single register accessors, in order.
+ */
+static int sdio_batch(struct wilc *wilc, struct wilc_reg_op *ops, int n)
+{
+	u32 vals[WILC_SDIO_BATCH_MAX];
+	int i, j, run, ret;
+
+	for (i = 0; i < n; i += run) {
+		run = sdio_batch_run(&ops[i], n - i);
+		if (run == 1) {
+			if (!wilc_hif_batch_seq(wilc, &ops[i], 1))
+				return 0;
+			continue;
 		}
+
+		for (j = 0; j < run; j++)
+			vals[j] = ops[i + j].val;
+
+		if (ops[i].type == WILC_REG_OP_WRITE)
+			ret = sdio_write_burst(wilc, ops[i].addr, vals, run);
+		else
+			ret = sdio_read_burst(wilc, ops[i].addr, vals, run);
+		if (!ret)
+			return 0;
+
+		for (j = 0; j < run; j++)
+			ops[i + j].val = vals[j];
 	}
 
 	return 1;
-fail:
-	return 0;
 }
 
 static int sdio_sync_ext(struct wilc *wilc, int nint)
 {
 	struct sdio_func *func = dev_to_sdio_func(wilc->dev);
 	struct wilc_sdio *sdio_priv = wilc->bus_data;
+	struct wilc_reg_op ops[] = {
+		/* interrupt pin mux select */
+		WILC_REG_RMW(WILC_PIN_MUX_0, 0, BIT(8)),
+		/* interrupt enable */
+		WILC_REG_RMW(WILC_INTR_ENABLE, 0, 0),
+		WILC_REG_RMW(WILC_INTR2_ENABLE, 0, 0),
+	};
 	u32 reg;
-	int ret, i;
+	int i;
 
 	if (nint > MAX_NUM_INT) {
 		dev_err(&func->dev, "Too many interrupts %d\n", nint);
@@ -1065,65 +1392,68 @@ static int sdio_sync_ext(struct wilc *wilc, int nint)
 	}
 
 	if (sdio_priv->irq_gpio) {
-		/**
-		 *      interrupt pin mux select
-		 **/
-		ret = sdio_read_reg(wilc, WILC_PIN_MUX_0, &reg);
-		if (!ret) {
-			dev_err(&func->dev, "Failed read reg (%08x)...\n",
-				WILC_PIN_MUX_0);
-			return 0;
-		}
-		reg |= BIT(8);
-		ret = sdio_write_reg(wilc, WILC_PIN_MUX_0, reg);
-		if (!ret) {
-			dev_err(&func->dev, "Failed write reg (%08x)...\n",
-				WILC_PIN_MUX_0);
-			return 0;
-		}
-
-		/**
-		 *      interrupt enable
-		 **/
-		ret = sdio_read_reg(wilc, WILC_INTR_ENABLE, &reg);
-		if (!ret) {
-			dev_err(&func->dev, "Failed read reg (%08x)...\n",
-				WILC_INTR_ENABLE);
-			return 0;
-		}
-
 		for (i = 0; (i < 5) && (nint > 0); i++, nint--)
-			reg |= BIT((27 + i));
-		ret = sdio_write_reg(wilc, WILC_INTR_ENABLE, reg);
-		if (!ret) {
-			dev_err(&func->dev, "Failed write reg (%08x)...\n",
-				WILC_INTR_ENABLE);
-			return 0;
-		}
-		if (nint) {
-			ret = sdio_read_reg(wilc, WILC_INTR2_ENABLE, &reg);
-			if (!ret) {
-				dev_err(&func->dev,
-					"Failed read reg (%08x)...\n",
-					WILC_INTR2_ENABLE);
-				return 0;
-			}
+			ops[1].val |= BIT(27 + i);
 
-			for (i = 0; (i < 3) && (nint > 0); i++, nint--)
-				reg |= BIT(i);
+		for (i = 0; (i < 3) && (nint > 0); i++, nint--)
+			ops[2].val |= BIT(i);
 
-			ret = sdio_write_reg(wilc, WILC_INTR2_ENABLE, reg);
-			if (!ret) {
-				dev_err(&func->dev,
-					"Failed write reg (%08x)...\n",
-					WILC_INTR2_ENABLE);
-				return 0;
-			}
+		if (!sdio_batch(wilc, ops, ops[2].val ? 3 : 2)) {
+			dev_err(&func->dev, "Failed to enable interrupts...\n");
+			return 0;
 		}
 	}
 	return 1;
 }
 
+#ifdef WILC_HIF_DIRECT
+/* direct bindings for the core, see wilc_hif_read_reg() */
+int wilc_bus_read_reg(struct wilc *wilc, u32 addr, u32 *data)
+{
+	return sdio_read_reg(wilc, addr, data);
+}
+
+int wilc_bus_write_reg(struct wilc *wilc, u32 addr, u32 data)
+{
+	return sdio_write_reg(wilc, addr, data);
+}
+
+int wilc_bus_block_rx(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return sdio_read(wilc, addr, buf, size);
+}
+
+int wilc_bus_block_tx(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return sdio_write(wilc, addr, buf, size);
+}
+
+int wilc_bus_read_int(struct wilc *wilc, u32 *int_status)
+{
+	return sdio_read_int(wilc, int_status);
+}
+
+int wilc_bus_clear_int_ext(struct wilc *wilc, u32 val)
+{
+	return sdio_clear_int_ext(wilc, val);
+}
+
+int wilc_bus_read_size(struct wilc *wilc, u32 *size)
+{
+	return sdio_read_size(wilc, size);
+}
+
+int wilc_bus_block_tx_ext(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return sdio_write(wilc, addr, buf, size);
+}
+
+int wilc_bus_block_rx_ext(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return sdio_read(wilc, addr, buf, size);
+}
+#endif
+
 /* Global sdio HIF function table */
 static const struct wilc_hif_func wilc_hif_sdio = {
 	.hif_init = sdio_init,
@@ -1142,5 +1472,8 @@ static const struct wilc_hif_func wilc_hif_sdio = {
 	.disable_interrupt = wilc_sdio_disable_interrupt,
 	.hif_reset = wilc_sdio_reset,
 	.hif_is_init = sdio_is_init,
+	.hif_batch = sdio_batch,
+	.hif_claim_bus = wilc_sdio_claim_bus,
+	.hif_release_bus = wilc_sdio_release_bus,
 };
 
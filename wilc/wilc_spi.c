@@ -6,72 +6,131 @@
 
 #include <linux/spi/spi.h>
 #include <linux/module.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/crc7.h>
+#include <linux/crc-itu-t.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/debugfs.h>
 
 #include "wilc_wfi_netdevice.h"
 
+/*
+ * Pre-mapped messages rely on spi_message.is_dma_mapped, which the SPI
+ * core dropped in 6.10; only build them where it still exists.
+ */
+#if KERNEL_VERSION(4, 13, 0) <= LINUX_VERSION_CODE && \
+	KERNEL_VERSION(6, 10, 0) > LINUX_VERSION_CODE
+#define WILC_SPI_PREMAP
+#endif
+
+#define WILC_SPI_CMD_SZ			32
+/*
+ * cmd_buf layout: command bytes, their response, small data/crc bytes and
+ * the per-chunk order bytes and CRC16s of a chained block write
+ */
+#define WILC_SPI_CMD_WB			0
+#define WILC_SPI_CMD_RB			WILC_SPI_CMD_SZ
+#define WILC_SPI_CMD_MISC		(2 * WILC_SPI_CMD_SZ)
+#define WILC_SPI_CMD_ORDER		(3 * WILC_SPI_CMD_SZ)
+#define WILC_SPI_CMD_CRC		(4 * WILC_SPI_CMD_SZ)
+#define WILC_SPI_CMD_SLOT_SZ		(5 * WILC_SPI_CMD_SZ)
+/* a second slot backs the block write that is in flight asynchronously */
+#define WILC_SPI_CMD_ASYNC		WILC_SPI_CMD_SLOT_SZ
+#define WILC_SPI_CMD_BUF_SZ		(2 * WILC_SPI_CMD_SLOT_SZ)
+
+/* command, (order, data, crc) per chunk, data response */
+#define WILC_SPI_MAX_CHUNKS		16
+#define WILC_SPI_MAX_XFERS		(2 + 3 * WILC_SPI_MAX_CHUNKS)
+
+/* register commands sent in one message by a hif_batch */
+#define WILC_SPI_BATCH_MAX		16
+#define WILC_SPI_BATCH_BUF_SZ		(2 * WILC_SPI_CMD_SZ * WILC_SPI_BATCH_MAX)
+
+#define WILC_SPI_DMA_REGIONS		8
+
+struct wilc_spi_dma_region {
+	/* DMA channel device the region is mapped against */
+	struct device *dev;
+	void *cpu;
+	dma_addr_t dma;
+	size_t size;
+	enum dma_data_direction dir;
+};
+
+/* bus error accounting, see wilc_spi_recover() */
+struct wilc_spi_stats {
+	u32 bus_err;		/* spi_sync/spi_async failed */
+	u32 cmd_err;		/* bad command or state response */
+	u32 data_err;		/* bad or missing data response */
+	u32 crc_err;		/* data CRC16 mismatch */
+	u32 retry;		/* immediate retries */
+	u32 reset;		/* retries after a CMD_RESET */
+	u32 slow_reset;		/* retries after a reset with 1 ms backoff */
+	u32 give_up;		/* transfers failed after SPI_RETRY_COUNT */
+};
+
 struct wilc_spi {
 	int crc_off;
+	/* data packets carry a CRC16 */
+	bool crc16;
 	int nint;
 	bool is_init;
+	/*
+	 * DATA_PKT_SZ scratch buffers for the unused direction of a transfer:
+	 * zeros clocked out while reading, and a sink for bytes clocked in
+	 * while writing. Allocated once so they are DMA-safe and aligned.
+	 */
+	u8 *tx_zero;
+	u8 *rx_dummy;
+	/* command/response bytes, kept off the stack so they can be DMAed */
+	u8 *cmd_buf;
+	/* command/response pairs of a register batch */
+	u8 *batch_buf;
+	struct wilc_spi_dma_region dma_region[WILC_SPI_DMA_REGIONS];
+	int dma_nregions;
+	/* transfers of a chained block write, the second half for async */
+	struct spi_transfer *xfer;
+	/* the asynchronous block write and who to tell when it is done */
+	struct spi_message async_msg;
+	int async_cmd_len;
+	bool async_premapped;
+	void (*async_done)(struct wilc *wilc, void *priv, int ret);
+	void *async_priv;
+	/* data packet size and clock, tunable by calibration */
+	u32 pkt_sz;
+	u32 speed_hz;
+	bool calibrated;
+	struct dentry *cal_dentry;
+	struct wilc_spi_stats stats;
+	struct dentry *stats_dentry;
 };
 
-static const struct wilc_hif_func wilc_hif_spi;
-
-static int wilc_spi_rx(struct wilc *wilc, u8 *rb, u32 rlen);
-static int wilc_spi_reset(struct wilc *wilc);
+#ifdef WILC_SPI_PREMAP
+static bool dma_premap;
+module_param(dma_premap, bool, 0444);
+MODULE_PARM_DESC(dma_premap,
+		 "Keep SPI buffers DMA mapped and submit pre-mapped messages. Only for controllers that use spi_transfer tx_dma/rx_dma");
+#endif
 
-/********************************************
- *
- *      Crc7
- *
- ********************************************/
+static bool enable_crc16;
+module_param(enable_crc16, bool, 0644);
+MODULE_PARM_DESC(enable_crc16,
+		 "Protect SPI data packets with a CRC16, can be toggled at runtime");
 
-static const u8 crc7_syndrome_table[256] = {
-	0x00, 0x09, 0x12, 0x1b, 0x24, 0x2d, 0x36, 0x3f,
-	0x48, 0x41, 0x5a, 0x53, 0x6c, 0x65, 0x7e, 0x77,
-	0x19, 0x10, 0x0b, 0x02, 0x3d, 0x34, 0x2f, 0x26,
-	0x51, 0x58, 0x43, 0x4a, 0x75, 0x7c, 0x67, 0x6e,
-	0x32, 0x3b, 0x20, 0x29, 0x16, 0x1f, 0x04, 0x0d,
-	0x7a, 0x73, 0x68, 0x61, 0x5e, 0x57, 0x4c, 0x45,
-	0x2b, 0x22, 0x39, 0x30, 0x0f, 0x06, 0x1d, 0x14,
-	0x63, 0x6a, 0x71, 0x78, 0x47, 0x4e, 0x55, 0x5c,
-	0x64, 0x6d, 0x76, 0x7f, 0x40, 0x49, 0x52, 0x5b,
-	0x2c, 0x25, 0x3e, 0x37, 0x08, 0x01, 0x1a, 0x13,
-	0x7d, 0x74, 0x6f, 0x66, 0x59, 0x50, 0x4b, 0x42,
-	0x35, 0x3c, 0x27, 0x2e, 0x11, 0x18, 0x03, 0x0a,
-	0x56, 0x5f, 0x44, 0x4d, 0x72, 0x7b, 0x60, 0x69,
-	0x1e, 0x17, 0x0c, 0x05, 0x3a, 0x33, 0x28, 0x21,
-	0x4f, 0x46, 0x5d, 0x54, 0x6b, 0x62, 0x79, 0x70,
-	0x07, 0x0e, 0x15, 0x1c, 0x23, 0x2a, 0x31, 0x38,
-	0x41, 0x48, 0x53, 0x5a, 0x65, 0x6c, 0x77, 0x7e,
-	0x09, 0x00, 0x1b, 0x12, 0x2d, 0x24, 0x3f, 0x36,
-	0x58, 0x51, 0x4a, 0x43, 0x7c, 0x75, 0x6e, 0x67,
-	0x10, 0x19, 0x02, 0x0b, 0x34, 0x3d, 0x26, 0x2f,
-	0x73, 0x7a, 0x61, 0x68, 0x57, 0x5e, 0x45, 0x4c,
-	0x3b, 0x32, 0x29, 0x20, 0x1f, 0x16, 0x0d, 0x04,
-	0x6a, 0x63, 0x78, 0x71, 0x4e, 0x47, 0x5c, 0x55,
-	0x22, 0x2b, 0x30, 0x39, 0x06, 0x0f, 0x14, 0x1d,
-	0x25, 0x2c, 0x37, 0x3e, 0x01, 0x08, 0x13, 0x1a,
-	0x6d, 0x64, 0x7f, 0x76, 0x49, 0x40, 0x5b, 0x52,
-	0x3c, 0x35, 0x2e, 0x27, 0x18, 0x11, 0x0a, 0x03,
-	0x74, 0x7d, 0x66, 0x6f, 0x50, 0x59, 0x42, 0x4b,
-	0x17, 0x1e, 0x05, 0x0c, 0x33, 0x3a, 0x21, 0x28,
-	0x5f, 0x56, 0x4d, 0x44, 0x7b, 0x72, 0x69, 0x60,
-	0x0e, 0x07, 0x1c, 0x15, 0x2a, 0x23, 0x38, 0x31,
-	0x46, 0x4f, 0x54, 0x5d, 0x62, 0x6b, 0x70, 0x79
-};
+static bool spi_calibrate;
+module_param(spi_calibrate, bool, 0444);
+MODULE_PARM_DESC(spi_calibrate,
+		 "Pick the fastest error-free SPI clock and packet size on first bus init");
 
-static u8 crc7_byte(u8 crc, u8 data)
-{
-	return crc7_syndrome_table[(crc << 1) ^ data];
-}
+static const struct wilc_hif_func wilc_hif_spi;
+static const struct file_operations wilc_spi_cal_fops;
+static const struct file_operations wilc_spi_stats_fops;
 
-static u8 crc7(u8 crc, const u8 *buffer, u32 len)
-{
-	while (len--)
-		crc = crc7_byte(crc, *buffer++);
-	return crc;
-}
+static int wilc_spi_rx(struct wilc *wilc, u8 *rb, u32 rlen);
+static int wilc_spi_reset(struct wilc *wilc);
 
 /********************************************
  *
@@ -96,6 +155,11 @@ static u8 crc7(u8 crc, const u8 *buffer, u32 len)
 #define N_RESET					-1
 #define N_RETRY					-2
 
+#define PROTOCOL_REG_CRC7			BIT(2)
+#define PROTOCOL_REG_CRC16			BIT(3)
+#define PROTOCOL_REG_PKT_SZ_MASK		0x70
+#define PROTOCOL_REG_PKT_SZ(sz)			((ilog2(sz) - 8) << 4)
+
 #define SPI_RESP_RETRY_COUNT			(10)
 #define SPI_RETRY_COUNT				(10)
 #define DATA_PKT_SZ_256				256
@@ -106,7 +170,18 @@ static u8 crc7(u8 crc, const u8 *buffer, u32 len)
 #define DATA_PKT_SZ_8K				(8 * 1024)
 #define DATA_PKT_SZ				DATA_PKT_SZ_8K
 
-#define USE_SPI_DMA				0
+/* test pattern round trips through chip shared memory per candidate */
+#define WILC_SPI_CAL_LEN			DATA_PKT_SZ_4K
+#define WILC_SPI_CAL_ROUNDS			4
+
+static const u32 wilc_spi_cal_hz[] = {
+	48000000, 40000000, 32000000, 24000000, 16000000, 8000000
+};
+
+static const u32 wilc_spi_cal_pkt_sz[] = {
+	DATA_PKT_SZ_8K, DATA_PKT_SZ_4K, DATA_PKT_SZ_2K,
+	DATA_PKT_SZ_1K, DATA_PKT_SZ_512, DATA_PKT_SZ_256
+};
 
 static int wilc_bus_probe(struct spi_device *spi)
 {
@@ -123,11 +198,24 @@ static int wilc_bus_probe(struct spi_device *spi)
 	if (!spi_priv)
 		return -ENOMEM;
 
-	ret = wilc_netdev_init(&wilc, dev, HIF_SPI, &wilc_hif_spi);
-	if (ret) {
-		kfree(spi_priv);
-		return ret;
+	spi_priv->tx_zero = kzalloc(DATA_PKT_SZ, GFP_KERNEL);
+	spi_priv->rx_dummy = kmalloc(DATA_PKT_SZ, GFP_KERNEL);
+	spi_priv->cmd_buf = kzalloc(WILC_SPI_CMD_BUF_SZ, GFP_KERNEL);
+	spi_priv->batch_buf = kzalloc(WILC_SPI_BATCH_BUF_SZ, GFP_KERNEL);
+	spi_priv->xfer = kcalloc(2 * WILC_SPI_MAX_XFERS,
+				 sizeof(*spi_priv->xfer), GFP_KERNEL);
+	if (!spi_priv->tx_zero || !spi_priv->rx_dummy || !spi_priv->cmd_buf ||
+	    !spi_priv->batch_buf || !spi_priv->xfer) {
+		ret = -ENOMEM;
+		goto free_priv;
 	}
+	/* the chip comes out of reset with both CRCs on */
+	spi_priv->crc16 = true;
+	spi_priv->pkt_sz = DATA_PKT_SZ;
+
+	ret = wilc_netdev_init(&wilc, dev, HIF_SPI, &wilc_hif_spi);
+	if (ret)
+		goto free_priv;
 
 	spi_set_drvdata(spi, wilc);
 	wilc->dev = &spi->dev;
@@ -144,15 +232,48 @@ static int wilc_bus_probe(struct spi_device *spi)
 	mutex_init(&wilc->cs);
 	wilc_bt_init(wilc);
 
+#if defined(WILC_DEBUGFS)
+	spi_priv->cal_dentry = debugfs_create_file("spi_calibrate", 0600,
+						   wilc_debugfs_get_dir(),
+						   wilc, &wilc_spi_cal_fops);
+	spi_priv->stats_dentry = debugfs_create_file("spi_errors", 0600,
+						     wilc_debugfs_get_dir(),
+						     wilc, &wilc_spi_stats_fops);
+#endif
+
 	dev_info(dev, "WILC SPI probe success\n");
 	return 0;
+
+free_priv:
+	kfree(spi_priv->xfer);
+	kfree(spi_priv->batch_buf);
+	kfree(spi_priv->cmd_buf);
+	kfree(spi_priv->rx_dummy);
+	kfree(spi_priv->tx_zero);
+	kfree(spi_priv);
+	return ret;
 }
 
 static int wilc_bus_remove(struct spi_device *spi)
 {
 	struct wilc *wilc = spi_get_drvdata(spi);
-
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	struct spi_transfer *xfer = spi_priv->xfer;
+	u8 *batch_buf = spi_priv->batch_buf;
+	u8 *cmd_buf = spi_priv->cmd_buf;
+	u8 *rx_dummy = spi_priv->rx_dummy;
+	u8 *tx_zero = spi_priv->tx_zero;
+
+	/* the debugfs files point at wilc, which cleanup frees */
+	debugfs_remove(spi_priv->stats_dentry);
+	debugfs_remove(spi_priv->cal_dentry);
+	/* cleanup still talks to the chip and frees bus_data */
 	wilc_netdev_cleanup(wilc);
+	kfree(xfer);
+	kfree(batch_buf);
+	kfree(cmd_buf);
+	kfree(rx_dummy);
+	kfree(tx_zero);
 	wilc_bt_deinit();
 	return 0;
 }
@@ -163,6 +284,7 @@ static int wilc_spi_suspend(struct device *dev)
 	struct wilc *wilc = spi_get_drvdata(spi);
 
 	dev_info(&spi->dev, "\n\n << SUSPEND >>\n\n");
+	wilc_autosleep_flush(wilc);
 	mutex_lock(&wilc->hif_cs);
 	chip_wakeup(wilc, 0);
 
@@ -183,6 +305,8 @@ static int wilc_spi_resume(struct device *dev)
 	struct wilc *wilc = spi_get_drvdata(spi);
 
 	dev_info(&spi->dev, "\n\n  <<RESUME>>\n\n");
+	/* the chip may have lost power while suspended */
+	wilc_reg_shadow_invalidate(wilc);
 
 	/*wake the chip to compelete the re-intialization*/
 	chip_wakeup(wilc, 0);
@@ -225,39 +349,262 @@ static struct spi_driver wilc_spi_driver = {
 module_spi_driver(wilc_spi_driver);
 MODULE_LICENSE("GPL");
 
-static int spi_data_rsp(struct wilc *wilc, u8 cmd)
+#ifdef WILC_SPI_PREMAP
+static struct wilc_spi_dma_region *
+wilc_spi_dma_find(struct wilc_spi *spi_priv, const void *buf, u32 len,
+		  enum dma_data_direction dir)
+{
+	int i;
+
+	for (i = 0; i < spi_priv->dma_nregions; i++) {
+		struct wilc_spi_dma_region *r = &spi_priv->dma_region[i];
+
+		if (r->dir != dir)
+			continue;
+		if (buf >= r->cpu && buf + len <= r->cpu + r->size)
+			return r;
+	}
+
+	return NULL;
+}
+
+/*
+ * Fill in tx_dma/rx_dma for every transfer of @msg and hand the buffers to
+ * the device. Returns false, leaving the message for the SPI core to map,
+ * if any buffer is outside the persistently mapped regions.
+ */
+static bool wilc_spi_msg_premap(struct wilc_spi *spi_priv,
+				struct spi_message *msg)
+{
+	struct wilc_spi_dma_region *r;
+	struct spi_transfer *tr;
+
+	if (!spi_priv->dma_nregions)
+		return false;
+
+	list_for_each_entry(tr, &msg->transfers, transfer_list) {
+		if (!tr->tx_buf || !tr->rx_buf)
+			return false;
+		if (!wilc_spi_dma_find(spi_priv, tr->tx_buf, tr->len,
+				       DMA_TO_DEVICE) ||
+		    !wilc_spi_dma_find(spi_priv, tr->rx_buf, tr->len,
+				       DMA_FROM_DEVICE))
+			return false;
+	}
+
+	list_for_each_entry(tr, &msg->transfers, transfer_list) {
+		r = wilc_spi_dma_find(spi_priv, tr->tx_buf, tr->len,
+				      DMA_TO_DEVICE);
+		tr->tx_dma = r->dma + (tr->tx_buf - r->cpu);
+		dma_sync_single_for_device(r->dev, tr->tx_dma,
+					   tr->len, r->dir);
+
+		r = wilc_spi_dma_find(spi_priv, tr->rx_buf, tr->len,
+				      DMA_FROM_DEVICE);
+		tr->rx_dma = r->dma + (tr->rx_buf - r->cpu);
+		dma_sync_single_for_device(r->dev, tr->rx_dma,
+					   tr->len, r->dir);
+	}
+	msg->is_dma_mapped = 1;
+
+	return true;
+}
+
+static void wilc_spi_msg_unpremap(struct wilc_spi *spi_priv,
+				  struct spi_message *msg)
+{
+	struct wilc_spi_dma_region *r;
+	struct spi_transfer *tr;
+
+	list_for_each_entry(tr, &msg->transfers, transfer_list) {
+		r = wilc_spi_dma_find(spi_priv, tr->rx_buf, tr->len,
+				      DMA_FROM_DEVICE);
+		dma_sync_single_for_cpu(r->dev, tr->rx_dma,
+					tr->len, r->dir);
+	}
+}
+
+static void wilc_spi_dma_map_region(struct wilc_spi *spi_priv,
+				    struct device *dev, void *buf, size_t size,
+				    enum dma_data_direction dir)
+{
+	struct wilc_spi_dma_region *r;
+	dma_addr_t dma;
+
+	if (!buf || spi_priv->dma_nregions == WILC_SPI_DMA_REGIONS)
+		return;
+
+	dma = dma_map_single(dev, buf, size, dir);
+	if (dma_mapping_error(dev, dma))
+		return;
+
+	r = &spi_priv->dma_region[spi_priv->dma_nregions++];
+	r->dev = dev;
+	r->cpu = buf;
+	r->dma = dma;
+	r->size = size;
+	r->dir = dir;
+}
+
+static void wilc_spi_dma_unmap(struct wilc *wilc)
+{
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	int i;
+
+	for (i = 0; i < spi_priv->dma_nregions; i++) {
+		struct wilc_spi_dma_region *r = &spi_priv->dma_region[i];
+
+		dma_unmap_single(r->dev, r->dma, r->size, r->dir);
+	}
+	spi_priv->dma_nregions = 0;
+}
+
+static int wilc_spi_dma_map(struct wilc *wilc)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
 	struct wilc_spi *spi_priv = wilc->bus_data;
-	u8 len;
-	u8 rsp[3];
-	int result = N_OK;
+	struct spi_controller *ctlr = spi->controller;
+	struct device *tx_dev, *rx_dev;
 
-	if (!spi_priv->crc_off)
-		len = 2;
-	else
-		len = 3;
+	if (!dma_premap)
+		return 1;
 
-	if (wilc_spi_rx(wilc, &rsp[0], len)) {
-		dev_err(&spi->dev, "Failed bus error...\n");
-		result = N_FAIL;
-		goto fail;
+	/* controllers without DMA channels just keep the PIO path */
+	if (!ctlr->dma_tx || !ctlr->dma_rx) {
+		dev_info(&spi->dev, "SPI controller has no DMA, not premapping\n");
+		return 1;
 	}
 
+	if (spi_priv->dma_nregions)
+		wilc_spi_dma_unmap(wilc);
+
+	/*
+	 * The TX and RX channels may sit behind different DMA engines, so
+	 * each direction is mapped against its own channel's device. The
+	 * command and batch buffers are both sent and received, so they get
+	 * one mapping per direction.
+	 */
+	tx_dev = ctlr->dma_tx->device->dev;
+	rx_dev = ctlr->dma_rx->device->dev;
+	wilc_spi_dma_map_region(spi_priv, tx_dev, spi_priv->cmd_buf,
+				WILC_SPI_CMD_BUF_SZ, DMA_TO_DEVICE);
+	wilc_spi_dma_map_region(spi_priv, rx_dev, spi_priv->cmd_buf,
+				WILC_SPI_CMD_BUF_SZ, DMA_FROM_DEVICE);
+	wilc_spi_dma_map_region(spi_priv, tx_dev, spi_priv->batch_buf,
+				WILC_SPI_BATCH_BUF_SZ, DMA_TO_DEVICE);
+	wilc_spi_dma_map_region(spi_priv, rx_dev, spi_priv->batch_buf,
+				WILC_SPI_BATCH_BUF_SZ, DMA_FROM_DEVICE);
+	wilc_spi_dma_map_region(spi_priv, tx_dev, spi_priv->tx_zero,
+				DATA_PKT_SZ, DMA_TO_DEVICE);
+	wilc_spi_dma_map_region(spi_priv, rx_dev, spi_priv->rx_dummy,
+				DATA_PKT_SZ, DMA_FROM_DEVICE);
+	wilc_spi_dma_map_region(spi_priv, tx_dev, wilc->tx_buffer,
+				LINUX_TX_SIZE, DMA_TO_DEVICE);
+	wilc_spi_dma_map_region(spi_priv, rx_dev, wilc->rx_buffer,
+				LINUX_RX_SIZE, DMA_FROM_DEVICE);
+
+	dev_info(&spi->dev, "%d SPI DMA regions premapped\n",
+		 spi_priv->dma_nregions);
+	return 1;
+}
+#endif /* WILC_SPI_PREMAP */
+
+/* run every transfer at the calibrated clock, if there is one */
+static void wilc_spi_msg_speed(struct wilc *wilc, struct spi_message *msg)
+{
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	struct spi_transfer *tr;
+
+	if (!spi_priv->speed_hz)
+		return;
+
+	list_for_each_entry(tr, &msg->transfers, transfer_list)
+		tr->speed_hz = spi_priv->speed_hz;
+}
+
+static int wilc_spi_sync(struct wilc *wilc, struct spi_message *msg)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	int ret;
+#ifdef WILC_SPI_PREMAP
+	bool premapped;
+
+	wilc_spi_msg_speed(wilc, msg);
+	premapped = wilc_spi_msg_premap(spi_priv, msg);
+
+	ret = spi_sync(spi, msg);
+	if (premapped)
+		wilc_spi_msg_unpremap(spi_priv, msg);
+#else
+	wilc_spi_msg_speed(wilc, msg);
+	ret = spi_sync(spi, msg);
+#endif
+	if (ret)
+		spi_priv->stats.bus_err++;
+
+	return ret;
+}
+
+static int wilc_spi_async(struct wilc *wilc, struct spi_message *msg)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	int ret;
+#ifdef WILC_SPI_PREMAP
+	struct wilc_spi *spi_priv = wilc->bus_data;
+
+	wilc_spi_msg_speed(wilc, msg);
+	spi_priv->async_premapped = wilc_spi_msg_premap(spi_priv, msg);
+	ret = spi_async(spi, msg);
+	if (ret && spi_priv->async_premapped)
+		wilc_spi_msg_unpremap(spi_priv, msg);
+#else
+	wilc_spi_msg_speed(wilc, msg);
+	ret = spi_async(spi, msg);
+#endif
+
+	return ret;
+}
+
+static u8 spi_data_rsp_len(struct wilc_spi *spi_priv)
+{
+	return spi_priv->crc_off ? 3 : 2;
+}
+
+static int spi_data_rsp_check(struct wilc *wilc, u8 *rsp, u8 len)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+
 	if ((rsp[len-1] != 0) || (rsp[len-2] != 0xC3)) {
+		spi_priv->stats.data_err++;
 		dev_err(&spi->dev, "Failed data response read, %x %x %x\n",
 			rsp[0], rsp[1], rsp[2]);
-		result = N_FAIL;
-		goto fail;
+		return N_FAIL;
 	}
 
-fail:
-	return result;
+	return N_OK;
+}
+
+static int spi_data_rsp(struct wilc *wilc, u8 cmd)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u8 len = spi_data_rsp_len(spi_priv);
+	u8 *rsp = &spi_priv->cmd_buf[WILC_SPI_CMD_MISC];
+
+	if (wilc_spi_rx(wilc, &rsp[0], len)) {
+		dev_err(&spi->dev, "Failed bus error...\n");
+		return N_FAIL;
+	}
+
+	return spi_data_rsp_check(wilc, rsp, len);
 }
 
 static int wilc_spi_tx(struct wilc *wilc, u8 *b, u32 len)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
 	int ret;
 	struct spi_message msg;
 
@@ -267,25 +614,23 @@ static int wilc_spi_tx(struct wilc *wilc, u8 *b, u32 len)
 			.len = len,
 			.delay_usecs = 0,
 		};
-		char *r_buffer = kzalloc(len, GFP_KERNEL);
-
-		if (!r_buffer)
-			return -ENOMEM;
 
-		tr.rx_buf = r_buffer;
+		/*
+		 * Longer writes leave rx_buf NULL, the SPI core provides a
+		 * dummy buffer for controllers that need one.
+		 */
+		if (len <= DATA_PKT_SZ)
+			tr.rx_buf = spi_priv->rx_dummy;
 		dev_dbg(&spi->dev, "Request writing %d bytes\n", len);
 
 		memset(&msg, 0, sizeof(msg));
 		spi_message_init(&msg);
 		msg.spi = spi;
-		msg.is_dma_mapped = USE_SPI_DMA;
 		spi_message_add_tail(&tr, &msg);
 
-		ret = spi_sync(spi, &msg);
+		ret = wilc_spi_sync(wilc, &msg);
 		if (ret < 0)
 			dev_err(&spi->dev, "SPI transaction failed\n");
-
-		kfree(r_buffer);
 	} else {
 		dev_err(&spi->dev,
 			"can't write data with the following length: %d\n",
@@ -299,6 +644,7 @@ static int wilc_spi_tx(struct wilc *wilc, u8 *b, u32 len)
 static int wilc_spi_rx(struct wilc *wilc, u8 *rb, u32 rlen)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
 	int ret;
 
 	if (rlen > 0) {
@@ -309,23 +655,19 @@ static int wilc_spi_rx(struct wilc *wilc, u8 *rb, u32 rlen)
 			.delay_usecs = 0,
 
 		};
-		char *t_buffer = kzalloc(rlen, GFP_KERNEL);
 
-		if (!t_buffer)
-			return -ENOMEM;
-
-		tr.tx_buf = t_buffer;
+		/* a NULL tx_buf makes the SPI core clock out zeros */
+		if (rlen <= DATA_PKT_SZ)
+			tr.tx_buf = spi_priv->tx_zero;
 
 		memset(&msg, 0, sizeof(msg));
 		spi_message_init(&msg);
 		msg.spi = spi;
-		msg.is_dma_mapped = USE_SPI_DMA;
 		spi_message_add_tail(&tr, &msg);
 
-		ret = spi_sync(spi, &msg);
+		ret = wilc_spi_sync(wilc, &msg);
 		if (ret < 0)
 			dev_err(&spi->dev, "SPI transaction failed\n");
-		kfree(t_buffer);
 	} else {
 		dev_err(&spi->dev,
 			"can't read data with the following length: %u\n",
@@ -355,10 +697,9 @@ static int wilc_spi_tx_rx(struct wilc *wilc, u8 *wb, u8 *rb, u32 rlen)
 		memset(&msg, 0, sizeof(msg));
 		spi_message_init(&msg);
 		msg.spi = spi;
-		msg.is_dma_mapped = USE_SPI_DMA;
 
 		spi_message_add_tail(&tr, &msg);
-		ret = spi_sync(spi, &msg);
+		ret = wilc_spi_sync(wilc, &msg);
 		if (ret < 0)
 			dev_err(&spi->dev, "SPI transaction failed\n");
 	} else {
@@ -371,19 +712,146 @@ static int wilc_spi_tx_rx(struct wilc *wilc, u8 *wb, u8 *rb, u32 rlen)
 	return ret;
 }
 
-static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
-			    u8 clockless)
+static void spi_xfer_add(struct spi_message *msg, struct spi_transfer *tr,
+			 const void *tx, void *rx, u32 len)
+{
+	memset(tr, 0, sizeof(*tr));
+	tr->tx_buf = tx;
+	tr->rx_buf = rx;
+	tr->len = len;
+	/*
+	 * Deassert CS after every transfer, as separate spi_sync() calls
+	 * would; on the last transfer of the message cs_change means the
+	 * opposite, so it is cleared by the caller.
+	 */
+	tr->cs_change = 1;
+	spi_message_add_tail(tr, msg);
+}
+
+#define SPI_DATA_HDR_OK(rsp)	((((rsp) >> 4) & 0xf) == 0xf)
+
+static void spi_data_crc_put(u8 *crc, const u8 *b, u32 nbytes)
+{
+	u16 crc_calc = crc_itu_t(0xffff, b, nbytes);
+
+	crc[0] = crc_calc >> 8;
+	crc[1] = crc_calc;
+}
+
+static int spi_data_crc_check(struct wilc *wilc, const u8 *b, u32 nbytes,
+			      u16 crc_seed, const u8 *crc)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u16 crc_calc, crc_recv;
+
+	if (!spi_priv->crc16)
+		return N_OK;
+
+	crc_calc = crc_itu_t(crc_seed, b, nbytes);
+	crc_recv = (crc[0] << 8) | crc[1];
+	if (crc_calc != crc_recv) {
+		spi_priv->stats.crc_err++;
+		dev_err(&spi->dev, "CRC16 mismatch, calc %04x recv %04x\n",
+			crc_calc, crc_recv);
+		return N_FAIL;
+	}
+
+	return N_OK;
+}
+
+/*
+ * Read one data chunk and its crc in a single message. With @hdr set the
+ * data response header is fetched speculatively in front of the data;
+ * @nbytes must then exceed SPI_RESP_RETRY_COUNT so that a late header
+ * still lands inside @b. @crc_seed is the CRC16 of any part of the chunk
+ * already received, 0xffff otherwise.
+ */
+static int spi_data_read_chunk(struct wilc *wilc, u8 *b, u32 nbytes, bool hdr,
+			       u16 crc_seed)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u8 *crc = &spi_priv->cmd_buf[WILC_SPI_CMD_MISC];
+	u8 *rsp = &spi_priv->cmd_buf[WILC_SPI_CMD_MISC + 2];
+	u32 crc_len = spi_priv->crc16 ? 2 : 0;
+	struct spi_transfer *tr = spi_priv->xfer;
+	struct spi_message msg;
+	u32 k, got, c, need;
+
+	spi_message_init(&msg);
+	msg.spi = spi;
+	if (hdr)
+		spi_xfer_add(&msg, tr++, spi_priv->tx_zero, rsp, 1);
+	spi_xfer_add(&msg, tr++, spi_priv->tx_zero, b, nbytes);
+	if (crc_len)
+		spi_xfer_add(&msg, tr++, spi_priv->tx_zero, crc, crc_len);
+	(tr - 1)->cs_change = 0;
+
+	if (wilc_spi_sync(wilc, &msg)) {
+		dev_err(&spi->dev, "Failed block read, bus err\n");
+		return N_FAIL;
+	}
+
+	if (!hdr || SPI_DATA_HDR_OK(*rsp))
+		return spi_data_crc_check(wilc, b, nbytes, crc_seed, crc);
+
+	/*
+	 * The header was not ready yet and the chip was still clocking out
+	 * filler. Look for it within the budget the byte-wise poll had and
+	 * realign: what follows it in @b and the crc bytes is data, and the
+	 * bytes it displaced are read now.
+	 */
+	for (k = 0; k < SPI_RESP_RETRY_COUNT; k++)
+		if (SPI_DATA_HDR_OK(b[k]))
+			break;
+
+	if (k == SPI_RESP_RETRY_COUNT) {
+		spi_priv->stats.data_err++;
+		dev_err(&spi->dev, "Error, data read response (%02x)\n", *rsp);
+		return N_RESET;
+	}
+
+	got = nbytes - k - 1;
+	memmove(b, &b[k + 1], got);
+	c = min(crc_len, k + 1);
+	memcpy(&b[got], crc, c);
+	memmove(crc, &crc[c], crc_len - c);
+	got += c;
+	need = nbytes - got;
+
+	spi_message_init(&msg);
+	msg.spi = spi;
+	tr = spi_priv->xfer;
+	if (need)
+		spi_xfer_add(&msg, tr++, spi_priv->tx_zero, &b[got], need);
+	if (c)
+		spi_xfer_add(&msg, tr++, spi_priv->tx_zero,
+			     &crc[crc_len - c], c);
+	(tr - 1)->cs_change = 0;
+
+	if (wilc_spi_sync(wilc, &msg)) {
+		dev_err(&spi->dev, "Failed block read, bus err\n");
+		return N_FAIL;
+	}
+
+	return spi_data_crc_check(wilc, b, nbytes, crc_seed, crc);
+}
+
+/*
+ * Build the command for @cmd in @wb. Returns the length of
+ * the full-duplex command transfer, including the room for the response,
+ * and stores the command length itself in @cmd_len. Returns 0 on failure.
+ */
+static u32 spi_cmd_prepare(struct wilc *wilc, u8 *wb, u8 cmd, u32 adr, u8 *b,
+			   u32 sz, u8 clockless, int *cmd_len)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
 	struct wilc_spi *spi_priv = wilc->bus_data;
-	u8 wb[32], rb[32];
-	u8 wix, rix;
+	u8 wix;
 	u32 len2;
-	u8 rsp;
 	int len = 0;
 	int result = N_OK;
-	int retry;
-	u8 crc[2];
 
 	wb[0] = cmd;
 	switch (cmd) {
@@ -474,10 +942,10 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 	}
 
 	if (result != N_OK)
-		return result;
+		return 0;
 
 	if (!spi_priv->crc_off)
-		wb[len - 1] = (crc7(0x7f, (const u8 *)&wb[0], len - 1)) << 1;
+		wb[len - 1] = crc7_be(0xfe, wb, len - 1);
 	else
 		len -= 1;
 
@@ -494,7 +962,7 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 	} else if (cmd == CMD_INTERNAL_READ || cmd == CMD_SINGLE_READ) {
 		int tmp = NUM_RSP_BYTES + NUM_DATA_HDR_BYTES + NUM_DATA_BYTES
 			+ NUM_DUMMY_BYTES;
-		if (!spi_priv->crc_off)
+		if (spi_priv->crc16)
 			len2 = len + tmp + NUM_CRC_BYTES;
 		else
 			len2 = len + tmp;
@@ -503,20 +971,32 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 	}
 #undef NUM_DUMMY_BYTES
 
-	if (len2 > ARRAY_SIZE(wb)) {
-		dev_err(&spi->dev, "spi buffer size too small (%d) (%zu)\n",
-			len2, ARRAY_SIZE(wb));
-		return N_FAIL;
+	if (len2 > WILC_SPI_CMD_SZ) {
+		dev_err(&spi->dev, "spi buffer size too small (%d) (%d)\n",
+			len2, WILC_SPI_CMD_SZ);
+		return 0;
 	}
 	/* zero spi write buffers. */
 	for (wix = len; wix < len2; wix++)
 		wb[wix] = 0;
-	rix = len;
+	*cmd_len = len;
+	return len2;
+}
 
-	if (wilc_spi_tx_rx(wilc, wb, rb, len2)) {
-		dev_err(&spi->dev, "Failed cmd write, bus error...\n");
-		return N_FAIL;
-	}
+/*
+ * Check the response to the command in @rb, up to and including the data of
+ * a single register read, which is stored in @b. *@rixp is left at the
+ * first byte following what was consumed.
+ */
+static int spi_cmd_rsp(struct wilc *wilc, u8 cmd, u8 *rb, int len, u32 len2,
+		       u8 *b, u8 *rixp)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u8 *crc = &spi_priv->cmd_buf[WILC_SPI_CMD_MISC];
+	u8 rix = len;
+	u8 rsp;
+	int retry;
 
 	/*
 	 * Command/Control response
@@ -527,6 +1007,7 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 	rsp = rb[rix++];
 
 	if (rsp != cmd) {
+		spi_priv->stats.cmd_err++;
 		dev_err(&spi->dev,
 			"Failed cmd response, cmd (%02x), resp (%02x)\n",
 			cmd, rsp);
@@ -538,6 +1019,7 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 	 */
 	rsp = rb[rix++];
 	if (rsp != 0x00) {
+		spi_priv->stats.cmd_err++;
 		dev_err(&spi->dev, "Failed cmd state response state (%02x)\n",
 			rsp);
 		return N_FAIL;
@@ -565,6 +1047,7 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 		} while (retry--);
 
 		if (retry <= 0) {
+			spi_priv->stats.data_err++;
 			dev_err(&spi->dev,
 				"Error, data read response (%02x)\n", rsp);
 			return N_RESET;
@@ -586,7 +1069,7 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 			return N_FAIL;
 		}
 
-		if (!spi_priv->crc_off) {
+		if (spi_priv->crc16) {
 			/*
 			 * Read Crc
 			 */
@@ -598,8 +1081,44 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 					"buffer overrun when reading crc.\n");
 				return N_FAIL;
 			}
+			if (spi_data_crc_check(wilc, b, 4, 0xffff, crc) != N_OK)
+				return N_FAIL;
 		}
-	} else if ((cmd == CMD_DMA_READ) || (cmd == CMD_DMA_EXT_READ)) {
+	}
+
+	*rixp = rix;
+	return N_OK;
+}
+
+static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
+			    u8 clockless)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u8 *wb = &spi_priv->cmd_buf[WILC_SPI_CMD_WB];
+	u8 *rb = &spi_priv->cmd_buf[WILC_SPI_CMD_RB];
+	u8 *rsp_buf = &spi_priv->cmd_buf[WILC_SPI_CMD_MISC + 2];
+	u8 rix;
+	u32 len2;
+	u8 rsp;
+	int len = 0;
+	int result = N_OK;
+	int retry;
+
+	len2 = spi_cmd_prepare(wilc, wb, cmd, adr, b, sz, clockless, &len);
+	if (!len2)
+		return N_FAIL;
+
+	if (wilc_spi_tx_rx(wilc, wb, rb, len2)) {
+		dev_err(&spi->dev, "Failed cmd write, bus error...\n");
+		return N_FAIL;
+	}
+
+	result = spi_cmd_rsp(wilc, cmd, rb, len, len2, b, &rix);
+	if (result != N_OK)
+		return result;
+
+	if ((cmd == CMD_DMA_READ) || (cmd == CMD_DMA_EXT_READ)) {
 		int ix;
 
 		/* some data may be read in response to dummy bytes. */
@@ -611,28 +1130,17 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 		if (sz > 0) {
 			int nbytes;
 
-			if (sz <= (DATA_PKT_SZ - ix))
+			if (sz <= (spi_priv->pkt_sz - ix))
 				nbytes = sz;
 			else
-				nbytes = DATA_PKT_SZ - ix;
-
-			/*
-			 * Read bytes
-			 */
-			if (wilc_spi_rx(wilc, &b[ix], nbytes)) {
-				dev_err(&spi->dev,
-					"Failed block read, bus err\n");
-				return N_FAIL;
-			}
+				nbytes = spi_priv->pkt_sz - ix;
 
 			/*
-			 * Read Crc
+			 * Read bytes and Crc
 			 */
-			if (!spi_priv->crc_off && wilc_spi_rx(wilc, crc, 2)) {
-				dev_err(&spi->dev,
-					"Failed block crc read, bus err\n");
+			if (spi_data_read_chunk(wilc, &b[ix], nbytes, false,
+						crc_itu_t(0xffff, b, ix)) != N_OK)
 				return N_FAIL;
-			}
 
 			ix += nbytes;
 			sz -= nbytes;
@@ -644,54 +1152,44 @@ static int spi_cmd_complete(struct wilc *wilc, u8 cmd, u32 adr, u8 *b, u32 sz,
 		 */
 		while (sz > 0) {
 			int nbytes;
+			bool spec;
 
-			if (sz <= DATA_PKT_SZ)
+			if (sz <= spi_priv->pkt_sz)
 				nbytes = sz;
 			else
-				nbytes = DATA_PKT_SZ;
+				nbytes = spi_priv->pkt_sz;
 
 			/*
 			 * read data response only on the next DMA cycles not
 			 * the first DMA since data response header is already
-			 * handled above for the first DMA.
-			 */
-			/*
-			 * Data Respnose header
+			 * handled above for the first DMA. It is fetched along
+			 * with the data; only a tail too short to hold a late
+			 * header is still polled byte by byte.
 			 */
+			spec = nbytes > SPI_RESP_RETRY_COUNT;
 			retry = SPI_RESP_RETRY_COUNT;
-			do {
-				if (wilc_spi_rx(wilc, &rsp, 1)) {
+			while (!spec) {
+				if (wilc_spi_rx(wilc, rsp_buf, 1)) {
 					dev_err(&spi->dev,
 						"Failed resp read, bus err\n");
 					result = N_FAIL;
 					break;
 				}
-				if (((rsp >> 4) & 0xf) == 0xf)
+				rsp = *rsp_buf;
+				if (SPI_DATA_HDR_OK(rsp) || !retry--)
 					break;
-			} while (retry--);
+			}
 
 			if (result == N_FAIL)
 				break;
 
 			/*
-			 * Read bytes
-			 */
-			if (wilc_spi_rx(wilc, &b[ix], nbytes)) {
-				dev_err(&spi->dev,
-					"Failed block read, bus err\n");
-				result = N_FAIL;
-				break;
-			}
-
-			/*
-			 * Read Crc
+			 * Read bytes and Crc
 			 */
-			if (!spi_priv->crc_off && wilc_spi_rx(wilc, crc, 2)) {
-				dev_err(&spi->dev,
-					"Failed block crc read, bus err\n");
-				result = N_FAIL;
+			result = spi_data_read_chunk(wilc, &b[ix], nbytes, spec,
+						     0xffff);
+			if (result != N_OK)
 				break;
-			}
 
 			ix += nbytes;
 			sz -= nbytes;
@@ -706,18 +1204,20 @@ static int spi_data_write(struct wilc *wilc, u8 *b, u32 sz)
 	struct wilc_spi *spi_priv = wilc->bus_data;
 	int ix, nbytes;
 	int result = 1;
-	u8 cmd, order, crc[2] = {0};
+	u8 order;
+	u8 *cmd = &spi_priv->cmd_buf[WILC_SPI_CMD_MISC];
+	u8 *crc = &spi_priv->cmd_buf[WILC_SPI_CMD_MISC + 1];
 
 	/*
 	 * Data
 	 */
 	ix = 0;
 	do {
-		if (sz <= DATA_PKT_SZ) {
+		if (sz <= spi_priv->pkt_sz) {
 			nbytes = sz;
 			order = 0x3;
 		} else {
-			nbytes = DATA_PKT_SZ;
+			nbytes = spi_priv->pkt_sz;
 			if (ix == 0)
 				order = 0x1;
 			else
@@ -727,10 +1227,10 @@ static int spi_data_write(struct wilc *wilc, u8 *b, u32 sz)
 		/*
 		 * Write command
 		 */
-		cmd = 0xf0;
-		cmd |= order;
+		*cmd = 0xf0;
+		*cmd |= order;
 
-		if (wilc_spi_tx(wilc, &cmd, 1)) {
+		if (wilc_spi_tx(wilc, cmd, 1)) {
 			dev_err(&spi->dev,
 				"Failed data block cmd write, bus error...\n");
 			result = N_FAIL;
@@ -750,7 +1250,8 @@ static int spi_data_write(struct wilc *wilc, u8 *b, u32 sz)
 		/*
 		 * Write Crc
 		 */
-		if (!spi_priv->crc_off) {
+		if (spi_priv->crc16) {
+			spi_data_crc_put(crc, &b[ix], nbytes);
 			if (wilc_spi_tx(wilc, crc, 2)) {
 				dev_err(&spi->dev, "Failed data block crc write, bus error...\n");
 				result = N_FAIL;
@@ -768,12 +1269,146 @@ static int spi_data_write(struct wilc *wilc, u8 *b, u32 sz)
 	return result;
 }
 
-/********************************************
- *
- *      Spi Internal Read/Write Function
+/*
+ * Build a whole CMD_DMA_EXT_WRITE, i.e. command, every data chunk with its
+ * order byte and crc, and the final data response, as a single spi_message
+ * using the command slot @cbuf and the transfers @tr. Returns N_RETRY if
+ * @sz needs more chunks than we have transfers for, so the caller can fall
+ * back to the step by step path.
+ */
+static int spi_block_write_build(struct wilc *wilc, struct spi_message *msg,
+				 struct spi_transfer *tr, u8 *cbuf, u32 adr,
+				 u8 *b, u32 sz, int *cmd_len)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u8 *order = &cbuf[WILC_SPI_CMD_ORDER];
+	u8 *crc = &cbuf[WILC_SPI_CMD_CRC];
+	u32 len2, ix, nbytes;
+	int i, nchunks;
+
+	nchunks = DIV_ROUND_UP(sz, spi_priv->pkt_sz);
+	if (nchunks > WILC_SPI_MAX_CHUNKS)
+		return N_RETRY;
+
+	len2 = spi_cmd_prepare(wilc, &cbuf[WILC_SPI_CMD_WB], CMD_DMA_EXT_WRITE,
+			       adr, NULL, sz, 0, cmd_len);
+	if (!len2)
+		return N_FAIL;
+
+	spi_message_init(msg);
+	msg->spi = spi;
+	spi_xfer_add(msg, tr++, &cbuf[WILC_SPI_CMD_WB], &cbuf[WILC_SPI_CMD_RB],
+		     len2);
+
+	for (i = 0, ix = 0; i < nchunks; i++, ix += nbytes) {
+		nbytes = min_t(u32, sz - ix, spi_priv->pkt_sz);
+		if (nchunks == 1)
+			order[i] = 0xf3;
+		else if (i == 0)
+			order[i] = 0xf1;
+		else if (i == nchunks - 1)
+			order[i] = 0xf3;
+		else
+			order[i] = 0xf2;
+
+		spi_xfer_add(msg, tr++, &order[i], spi_priv->rx_dummy, 1);
+		spi_xfer_add(msg, tr++, &b[ix], spi_priv->rx_dummy, nbytes);
+		if (spi_priv->crc16) {
+			spi_data_crc_put(&crc[2 * i], &b[ix], nbytes);
+			spi_xfer_add(msg, tr++, &crc[2 * i],
+				     spi_priv->rx_dummy, 2);
+		}
+	}
+
+	spi_xfer_add(msg, tr, spi_priv->tx_zero, &cbuf[WILC_SPI_CMD_MISC],
+		     spi_data_rsp_len(spi_priv));
+	tr->cs_change = 0;
+
+	return N_OK;
+}
+
+static int spi_block_write_check(struct wilc *wilc, u8 *cbuf, int cmd_len)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u8 *rb = &cbuf[WILC_SPI_CMD_RB];
+
+	if (rb[cmd_len] != CMD_DMA_EXT_WRITE || rb[cmd_len + 1] != 0x00) {
+		spi_priv->stats.cmd_err++;
+		dev_err(&spi->dev,
+			"Failed cmd response, cmd (%02x), resp (%02x %02x)\n",
+			CMD_DMA_EXT_WRITE, rb[cmd_len], rb[cmd_len + 1]);
+		return N_FAIL;
+	}
+
+	return spi_data_rsp_check(wilc, &cbuf[WILC_SPI_CMD_MISC],
+				  spi_data_rsp_len(spi_priv));
+}
+
+static int spi_block_write_chained(struct wilc *wilc, u32 adr, u8 *b, u32 sz)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	struct spi_message msg;
+	int len, result;
+
+	result = spi_block_write_build(wilc, &msg, spi_priv->xfer,
+				       spi_priv->cmd_buf, adr, b, sz, &len);
+	if (result != N_OK)
+		return result;
+
+	if (wilc_spi_sync(wilc, &msg)) {
+		dev_err(&spi->dev, "Failed chained block write, bus error\n");
+		return N_FAIL;
+	}
+
+	return spi_block_write_check(wilc, spi_priv->cmd_buf, len);
+}
+
+/********************************************
+ *
+ *      Spi Internal Read/Write Function
  *
  ********************************************/
 
+/*
+ * Tiered recovery between the SPI_RETRY_COUNT attempts of a transfer:
+ * a glitch usually clears on an immediate retry, a confused slave on a
+ * CMD_RESET; only after that do we back off for real. Returns false once
+ * the attempts are used up, leaving the slave reset for the next user.
+ */
+#define SPI_RETRY_IMMEDIATE			1
+#define SPI_RETRY_FAST_RESET			3
+
+static bool wilc_spi_recover(struct wilc *wilc, u8 *retry)
+{
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	int failures;
+
+	if (!--(*retry)) {
+		spi_priv->stats.give_up++;
+		wilc_spi_reset(wilc);
+		return false;
+	}
+
+	failures = SPI_RETRY_COUNT - *retry;
+	if (failures <= SPI_RETRY_IMMEDIATE) {
+		spi_priv->stats.retry++;
+	} else if (failures <= SPI_RETRY_FAST_RESET) {
+		spi_priv->stats.reset++;
+		wilc_spi_reset(wilc);
+		udelay(20);
+	} else {
+		spi_priv->stats.slow_reset++;
+		usleep_range(1000, 1100);
+		wilc_spi_reset(wilc);
+		usleep_range(1000, 1100);
+	}
+
+	return true;
+}
+
 static int spi_internal_write(struct wilc *wilc, u32 adr, u32 dat)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
@@ -791,12 +1426,8 @@ retry:
 
 fail:
 	if (result != N_OK) {
-		usleep_range(1000, 1100);
-		wilc_spi_reset(wilc);
-		dev_err(&spi->dev, "Reset and retry %d %x\n", retry, adr);
-		usleep_range(1000, 1100);
-		retry--;
-		if (retry)
+		dev_err_ratelimited(&spi->dev, "Retry %d %x\n", retry, adr);
+		if (wilc_spi_recover(wilc, &retry))
 			goto retry;
 	}
 	return result;
@@ -820,12 +1451,8 @@ retry:
 
 fail:
 	if (result != N_OK) {
-		usleep_range(1000, 1100);
-		wilc_spi_reset(wilc);
-		dev_err(&spi->dev, "Reset and retry %d %x\n", retry, adr);
-		usleep_range(1000, 1100);
-		retry--;
-		if (retry)
+		dev_err_ratelimited(&spi->dev, "Retry %d %x\n", retry, adr);
+		if (wilc_spi_recover(wilc, &retry))
 			goto retry;
 	}
 	return result;
@@ -864,18 +1491,70 @@ _RETRY_:
 
 fail:
 	if (result != N_OK) {
-		usleep_range(1000, 1100);
-		wilc_spi_reset(wilc);
-		dev_err(&spi->dev,
-			"Reset and retry %d %x %d\n", retry, addr, data);
-		usleep_range(1000, 1100);
-		retry--;
-		if (retry)
+		dev_err_ratelimited(&spi->dev, "Retry %d %x %d\n", retry, addr,
+				    data);
+		if (wilc_spi_recover(wilc, &retry))
 			goto _RETRY_;
 	}
 	return result;
 }
 
+/*
+ * Report what the data CRC16 costs the CPU per packet, next to the time
+ * the packet spends on the wire, so the throughput impact is visible.
+ */
+static void wilc_spi_crc16_bench(struct wilc *wilc)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	ktime_t start;
+	u64 crc_ns, wire_ns;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < 16; i++)
+		crc_itu_t(0xffff, spi_priv->tx_zero, DATA_PKT_SZ);
+	crc_ns = div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), 16);
+	wire_ns = spi->max_speed_hz ?
+		  div_u64((u64)DATA_PKT_SZ * 8 * NSEC_PER_SEC,
+			  spi->max_speed_hz) : 0;
+
+	dev_info(&spi->dev,
+		 "CRC16: %llu ns per %d byte packet, %llu ns on the wire\n",
+		 crc_ns, DATA_PKT_SZ, wire_ns);
+}
+
+/*
+ * Apply a runtime change of enable_crc16. Called with the bus held at the
+ * start of every block transfer, so it never splits one.
+ */
+static void wilc_spi_crc16_sync(struct wilc *wilc)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	bool want = READ_ONCE(enable_crc16);
+	u32 reg;
+
+	if (!spi_priv->is_init || spi_priv->crc16 == want)
+		return;
+
+	if (!spi_internal_read(wilc, WILC_SPI_PROTOCOL_OFFSET, &reg))
+		return;
+
+	if (want)
+		reg |= PROTOCOL_REG_CRC16;
+	else
+		reg &= ~PROTOCOL_REG_CRC16;
+
+	if (!spi_internal_write(wilc, WILC_SPI_PROTOCOL_OFFSET, reg))
+		return;
+
+	spi_priv->crc16 = want;
+	dev_info(&spi->dev, "data CRC16 %s\n", want ? "enabled" : "disabled");
+	if (want)
+		wilc_spi_crc16_bench(wilc);
+}
+
 static int wilc_spi_write(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
@@ -888,7 +1567,12 @@ static int wilc_spi_write(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
 	if (size <= 4)
 		return 0;
 
+	wilc_spi_crc16_sync(wilc);
 retry:
+	result = spi_block_write_chained(wilc, addr, buf, size);
+	if (result != N_RETRY)
+		goto fail;
+
 	result = spi_cmd_complete(wilc, CMD_DMA_EXT_WRITE, addr, NULL, size, 0);
 	if (result != N_OK) {
 		dev_err(&spi->dev,
@@ -915,18 +1599,79 @@ retry:
 
 fail:
 	if (result != N_OK) {
-		usleep_range(1000, 1100);
-		wilc_spi_reset(wilc);
-		dev_err(&spi->dev,
-			"Reset and retry %d %x %d\n", retry, addr, size);
-		usleep_range(1000, 1100);
-		retry--;
-		if (retry)
+		dev_err_ratelimited(&spi->dev, "Retry %d %x %d\n", retry, addr,
+				    size);
+		if (wilc_spi_recover(wilc, &retry))
 			goto retry;
 	}
 	return result;
 }
 
+static void wilc_spi_write_async_complete(void *context)
+{
+	struct wilc *wilc = context;
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	int result = N_FAIL;
+
+#ifdef WILC_SPI_PREMAP
+	if (spi_priv->async_premapped)
+		wilc_spi_msg_unpremap(spi_priv, &spi_priv->async_msg);
+#endif
+	if (spi_priv->async_msg.status) {
+		spi_priv->stats.bus_err++;
+		dev_err(&spi->dev, "Failed async block write, bus error\n");
+	} else {
+		result = spi_block_write_check(wilc,
+					       &spi_priv->cmd_buf[WILC_SPI_CMD_ASYNC],
+					       spi_priv->async_cmd_len);
+	}
+
+	spi_priv->async_done(wilc, spi_priv->async_priv, result == N_OK);
+}
+
+/*
+ * Queue a block write and return at once; @done is called, possibly from
+ * interrupt context, once it has been checked. Only one can be in flight,
+ * and the caller keeps the bus and @buf until @done has run, however long
+ * that takes. A failed write is not retried here, the caller redoes it
+ * with hif_block_tx_ext, which resets the bus.
+ */
+static int wilc_spi_write_async(struct wilc *wilc, u32 addr, u8 *buf, u32 size,
+				void (*done)(struct wilc *wilc, void *priv,
+					     int ret),
+				void *priv)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	struct spi_message *msg = &spi_priv->async_msg;
+	int result;
+
+	if (size <= 4)
+		return 0;
+
+	wilc_spi_crc16_sync(wilc);
+	result = spi_block_write_build(wilc, msg,
+				       &spi_priv->xfer[WILC_SPI_MAX_XFERS],
+				       &spi_priv->cmd_buf[WILC_SPI_CMD_ASYNC],
+				       addr, buf, size,
+				       &spi_priv->async_cmd_len);
+	if (result != N_OK)
+		return 0;
+
+	spi_priv->async_done = done;
+	spi_priv->async_priv = priv;
+	msg->complete = wilc_spi_write_async_complete;
+	msg->context = wilc;
+
+	if (wilc_spi_async(wilc, msg)) {
+		dev_err(&spi->dev, "Failed to queue async block write\n");
+		return 0;
+	}
+
+	return 1;
+}
+
 static int wilc_spi_read_reg(struct wilc *wilc, u32 addr, u32 *data)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
@@ -955,12 +1700,8 @@ retry:
 
 fail:
 	if (result != N_OK) {
-		usleep_range(1000, 1100);
-		wilc_spi_reset(wilc);
-		dev_warn(&spi->dev, "Reset and retry %d %x\n", retry, addr);
-		usleep_range(1000, 1100);
-		retry--;
-		if (retry)
+		dev_warn_ratelimited(&spi->dev, "Retry %d %x\n", retry, addr);
+		if (wilc_spi_recover(wilc, &retry))
 			goto retry;
 	}
 	return result;
@@ -975,6 +1716,7 @@ static int wilc_spi_read(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
 	if (size <= 4)
 		return 0;
 
+	wilc_spi_crc16_sync(wilc);
 retry:
 	result = spi_cmd_complete(wilc, CMD_DMA_EXT_READ, addr, buf, size, 0);
 	if (result != N_OK) {
@@ -984,18 +1726,133 @@ retry:
 
 fail:
 	if (result != N_OK) {
-		usleep_range(1000, 1100);
-		wilc_spi_reset(wilc);
-		dev_warn(&spi->dev, "Reset and retry %d %x %d\n", retry, addr,
-			 size);
-		usleep_range(1000, 1100);
-		retry--;
-		if (retry)
+		dev_warn_ratelimited(&spi->dev, "Retry %d %x %d\n", retry, addr,
+				     size);
+		if (wilc_spi_recover(wilc, &retry))
 			goto retry;
 	}
 	return result;
 }
 
+/*
+ * Send up to WILC_SPI_BATCH_MAX register commands as one message, starting
+ * at ops[*@idx]. A read-modify-write ends the message with its read, since
+ * the write depends on the answer; *@rmw and *@rmw_val carry that write
+ * into the next message. On return *@idx and *@rmw describe the first
+ * command that did not complete.
+ */
+static int spi_batch_msg(struct wilc *wilc, struct wilc_reg_op *ops, int n,
+			 int *idx, bool *rmw, u32 *rmw_val)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	struct spi_transfer *tr = spi_priv->xfer;
+	struct spi_message msg;
+	struct wilc_reg_op *op;
+	u8 cmd[WILC_SPI_BATCH_MAX];
+	u8 len2[WILC_SPI_BATCH_MAX];
+	int len[WILC_SPI_BATCH_MAX];
+	u8 clockless, rix;
+	bool write, pending = *rmw;
+	u8 *wb, *rb;
+	u32 data;
+	int i = *idx;
+	int k, j;
+
+	spi_message_init(&msg);
+	for (k = 0; k < WILC_SPI_BATCH_MAX && i < n; k++) {
+		op = &ops[i];
+		write = op->type == WILC_REG_OP_WRITE || pending;
+		clockless = op->addr <= 0x30;
+		if (write) {
+			cmd[k] = clockless ? CMD_INTERNAL_WRITE :
+					     CMD_SINGLE_WRITE;
+			data = pending ? *rmw_val : op->val;
+			cpu_to_le32s(&data);
+		} else {
+			cmd[k] = clockless ? CMD_INTERNAL_READ :
+					     CMD_SINGLE_READ;
+		}
+
+		wb = &spi_priv->batch_buf[k * 2 * WILC_SPI_CMD_SZ];
+		rb = wb + WILC_SPI_CMD_SZ;
+		len2[k] = spi_cmd_prepare(wilc, wb, cmd[k], op->addr,
+					  (u8 *)&data, 4, clockless, &len[k]);
+		if (!len2[k])
+			return N_FAIL;
+		spi_xfer_add(&msg, &tr[k], wb, rb, len2[k]);
+
+		if (op->type == WILC_REG_OP_RMW && !pending) {
+			k++;
+			break;
+		}
+		pending = false;
+		i++;
+	}
+	tr[k - 1].cs_change = 0;
+
+	if (wilc_spi_sync(wilc, &msg)) {
+		dev_err(&spi->dev, "Failed batch write, bus error...\n");
+		return N_FAIL;
+	}
+
+	for (j = 0; j < k; j++) {
+		op = &ops[*idx];
+		rb = &spi_priv->batch_buf[j * 2 * WILC_SPI_CMD_SZ +
+					  WILC_SPI_CMD_SZ];
+		if (spi_cmd_rsp(wilc, cmd[j], rb, len[j], len2[j], (u8 *)&data,
+				&rix) != N_OK) {
+			dev_err(&spi->dev, "Failed batch cmd, reg (%08x)...\n",
+				op->addr);
+			return N_FAIL;
+		}
+
+		if (cmd[j] == CMD_INTERNAL_READ || cmd[j] == CMD_SINGLE_READ) {
+			le32_to_cpus(&data);
+			if (op->type == WILC_REG_OP_RMW) {
+				*rmw_val = (data & ~op->mask) | op->val;
+				*rmw = true;
+				continue;
+			}
+			op->val = data;
+		}
+		*rmw = false;
+		(*idx)++;
+	}
+
+	return N_OK;
+}
+
+/*
+ * Run a register batch in as few messages as possible. Every command keeps
+ * its own chip select cycle, exactly as with separate accesses, but they
+ * share one spi_sync() and one DMA setup. If anything goes wrong the bus
+ * is reset and the rest of the batch finishes through the retrying single
+ * register accessors.
+ */
+static int wilc_spi_batch(struct wilc *wilc, struct wilc_reg_op *ops, int n)
+{
+	u32 rmw_val = 0;
+	bool rmw = false;
+	int i = 0;
+
+	while (i < n) {
+		if (spi_batch_msg(wilc, ops, n, &i, &rmw, &rmw_val) != N_OK)
+			break;
+	}
+	if (i == n)
+		return 1;
+
+	wilc_spi_reset(wilc);
+	if (rmw) {
+		if (!wilc_spi_write_reg(wilc, ops[i].addr, rmw_val))
+			return 0;
+		i++;
+	}
+
+	return wilc_hif_batch_seq(wilc, &ops[i], n - i);
+}
+
 /********************************************
  *
  *      Bus interfaces
@@ -1035,6 +1892,130 @@ static int _wilc_spi_deinit(struct wilc *wilc)
 	return 1;
 }
 
+static int wilc_spi_set_pkt_sz(struct wilc *wilc, u32 pkt_sz)
+{
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u32 reg;
+
+	if (!spi_internal_read(wilc, WILC_SPI_PROTOCOL_OFFSET, &reg))
+		return 0;
+
+	reg &= ~PROTOCOL_REG_PKT_SZ_MASK;
+	reg |= PROTOCOL_REG_PKT_SZ(pkt_sz);
+	if (!spi_internal_write(wilc, WILC_SPI_PROTOCOL_OFFSET, reg))
+		return 0;
+
+	spi_priv->pkt_sz = pkt_sz;
+	return 1;
+}
+
+static int wilc_spi_cal_round(struct wilc *wilc, u8 *pattern, u8 *readback)
+{
+	if (spi_block_write_chained(wilc, WILC_AHB_SHARE_MEM_BASE, pattern,
+				    WILC_SPI_CAL_LEN) != N_OK)
+		return 0;
+
+	memset(readback, 0, WILC_SPI_CAL_LEN);
+	if (spi_cmd_complete(wilc, CMD_DMA_EXT_READ, WILC_AHB_SHARE_MEM_BASE,
+			     readback, WILC_SPI_CAL_LEN, 0) != N_OK)
+		return 0;
+
+	return !memcmp(pattern, readback, WILC_SPI_CAL_LEN);
+}
+
+/*
+ * Bounce a random pattern through chip shared memory at every candidate
+ * clock and packet size and keep the fastest combination that never
+ * corrupted it. Transfers are not retried, so marginal settings show up.
+ * Called with the bus held and before the firmware is started; the
+ * shared memory is the VMM table area, which the firmware owns once it
+ * runs.
+ */
+static int wilc_spi_calibrate(struct wilc *wilc)
+{
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	u32 safe_hz = spi_priv->speed_hz;
+	u32 best_hz = 0, best_pkt_sz = 0;
+	u32 ctlr_max_hz;
+	u64 ns, best_ns = U64_MAX;
+	u8 *pattern, *readback;
+	ktime_t start;
+	int i, j, k;
+
+#if KERNEL_VERSION(4, 13, 0) <= LINUX_VERSION_CODE
+	ctlr_max_hz = spi->controller->max_speed_hz;
+#else
+	ctlr_max_hz = spi->master->max_speed_hz;
+#endif
+
+	pattern = kmalloc(WILC_SPI_CAL_LEN, GFP_KERNEL);
+	readback = kmalloc(WILC_SPI_CAL_LEN, GFP_KERNEL);
+	if (!pattern || !readback) {
+		kfree(pattern);
+		kfree(readback);
+		return -ENOMEM;
+	}
+	get_random_bytes(pattern, WILC_SPI_CAL_LEN);
+
+	for (i = 0; i < ARRAY_SIZE(wilc_spi_cal_hz); i++) {
+		if (ctlr_max_hz && wilc_spi_cal_hz[i] > ctlr_max_hz)
+			continue;
+
+		for (j = 0; j < ARRAY_SIZE(wilc_spi_cal_pkt_sz); j++) {
+			/* the packet size is always switched at a safe clock */
+			spi_priv->speed_hz = safe_hz;
+			if (!wilc_spi_set_pkt_sz(wilc, wilc_spi_cal_pkt_sz[j]))
+				goto out;
+
+			spi_priv->speed_hz = wilc_spi_cal_hz[i];
+			start = ktime_get();
+			for (k = 0; k < WILC_SPI_CAL_ROUNDS; k++)
+				if (!wilc_spi_cal_round(wilc, pattern, readback))
+					break;
+			ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+			if (k < WILC_SPI_CAL_ROUNDS) {
+				dev_info(&spi->dev,
+					 "calibrate %u Hz, %u byte packets: errors\n",
+					 wilc_spi_cal_hz[i],
+					 wilc_spi_cal_pkt_sz[j]);
+				spi_priv->speed_hz = safe_hz;
+				wilc_spi_reset(wilc);
+				continue;
+			}
+
+			dev_info(&spi->dev,
+				 "calibrate %u Hz, %u byte packets: %llu KB/s\n",
+				 wilc_spi_cal_hz[i], wilc_spi_cal_pkt_sz[j],
+				 div64_u64(2ULL * WILC_SPI_CAL_LEN *
+					   WILC_SPI_CAL_ROUNDS * NSEC_PER_SEC,
+					   max_t(u64, ns, 1) * 1024));
+			if (ns < best_ns) {
+				best_ns = ns;
+				best_hz = wilc_spi_cal_hz[i];
+				best_pkt_sz = wilc_spi_cal_pkt_sz[j];
+			}
+		}
+	}
+
+out:
+	spi_priv->speed_hz = safe_hz;
+	if (best_hz && wilc_spi_set_pkt_sz(wilc, best_pkt_sz)) {
+		spi_priv->speed_hz = best_hz;
+		dev_info(&spi->dev, "SPI calibrated to %u Hz, %u byte packets\n",
+			 best_hz, best_pkt_sz);
+	} else {
+		wilc_spi_set_pkt_sz(wilc, DATA_PKT_SZ);
+		dev_err(&spi->dev, "SPI calibration found no working setting\n");
+	}
+	spi_priv->calibrated = true;
+
+	kfree(pattern);
+	kfree(readback);
+	return best_hz ? 0 : -EIO;
+}
+
 static int wilc_spi_init(struct wilc *wilc, bool resume)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
@@ -1065,6 +2046,7 @@ static int wilc_spi_init(struct wilc *wilc, bool resume)
 		 * is removed but chip isn't reset
 		 */
 		spi_priv->crc_off = 1;
+		spi_priv->crc16 = false;
 		dev_err(&spi->dev,
 			"Failed read with CRC on, retrying with CRC off\n");
 		if (!spi_internal_read(wilc, WILC_SPI_PROTOCOL_OFFSET, &reg)) {
@@ -1077,9 +2059,12 @@ static int wilc_spi_init(struct wilc *wilc, bool resume)
 		}
 	}
 	if (spi_priv->crc_off == 0) {
-		reg &= ~0xc; /* disable crc checking */
-		reg &= ~0x70;
-		reg |= (0x5 << 4);
+		/* disable command crc checking, data crc as configured */
+		reg &= ~(PROTOCOL_REG_CRC7 | PROTOCOL_REG_CRC16);
+		if (enable_crc16)
+			reg |= PROTOCOL_REG_CRC16;
+		reg &= ~PROTOCOL_REG_PKT_SZ_MASK;
+		reg |= PROTOCOL_REG_PKT_SZ(spi_priv->pkt_sz);
 		if (!spi_internal_write(wilc, WILC_SPI_PROTOCOL_OFFSET, reg)) {
 			dev_err(&spi->dev,
 				"[wilc spi %d]: Failed internal write reg\n",
@@ -1088,6 +2073,19 @@ static int wilc_spi_init(struct wilc *wilc, bool resume)
 		}
 		spi_priv->crc_off = 1;
 	}
+	spi_priv->crc16 = !!(reg & PROTOCOL_REG_CRC16);
+	/*
+	 * a chip left configured by an earlier load keeps its packet size,
+	 * unless it is larger than our buffers, in which case the chip is
+	 * told to use the largest one we can take
+	 */
+	spi_priv->pkt_sz = DATA_PKT_SZ_256 <<
+			   ((reg & PROTOCOL_REG_PKT_SZ_MASK) >> 4);
+	if (spi_priv->pkt_sz > DATA_PKT_SZ &&
+	    !wilc_spi_set_pkt_sz(wilc, DATA_PKT_SZ)) {
+		dev_err(&spi->dev, "Failed to set packet size\n");
+		return 0;
+	}
 
 	/*
 	 * make sure can read back chip id correctly
@@ -1099,20 +2097,17 @@ static int wilc_spi_init(struct wilc *wilc, bool resume)
 
 	if (!resume) {
 		chipid = wilc_get_chipid(wilc, true);
-		if (is_wilc3000(chipid)) {
-			wilc->chip = WILC_3000;
-			goto pass;
-		} else if (is_wilc1000(chipid)) {
-			wilc->chip = WILC_1000;
-			goto pass;
-		} else {
+		if (wilc_chip_select(wilc, chipid)) {
 			dev_err(&spi->dev, "Unsupported chipid: %x\n", chipid);
 			goto fail;
 		}
 		dev_dbg(&spi->dev, "chipid %08x\n", chipid);
 	}
 
-pass:
+	if (spi_priv->crc16)
+		wilc_spi_crc16_bench(wilc);
+	if (!resume && spi_calibrate && !spi_priv->calibrated)
+		wilc_spi_calibrate(wilc);
 	spi_priv->is_init = true;
 	return 1;
 
@@ -1153,8 +2148,14 @@ static int wilc_spi_sync_ext(struct wilc *wilc, int nint)
 {
 	struct spi_device *spi = to_spi_device(wilc->dev);
 	struct wilc_spi *spi_priv = wilc->bus_data;
-	u32 reg;
-	int ret, i;
+	struct wilc_reg_op ops[] = {
+		/* interrupt pin mux select */
+		WILC_REG_RMW(WILC_PIN_MUX_0, 0, BIT(8)),
+		/* interrupt enable */
+		WILC_REG_RMW(WILC_INTR_ENABLE, 0, 0),
+		WILC_REG_RMW(WILC_INTR2_ENABLE, 0, 0),
+	};
+	int i;
 
 	if (nint > MAX_NUM_INT) {
 		dev_err(&spi->dev, "Too many interrupts (%d)...\n", nint);
@@ -1163,63 +2164,160 @@ static int wilc_spi_sync_ext(struct wilc *wilc, int nint)
 
 	spi_priv->nint = nint;
 
-	/*
-	 * interrupt pin mux select
-	 */
-	ret = wilc_spi_read_reg(wilc, WILC_PIN_MUX_0, &reg);
-	if (!ret) {
-		dev_err(&spi->dev, "Failed read reg (%08x)...\n",
-			WILC_PIN_MUX_0);
-		return 0;
-	}
-	reg |= BIT(8);
-	ret = wilc_spi_write_reg(wilc, WILC_PIN_MUX_0, reg);
-	if (!ret) {
-		dev_err(&spi->dev, "Failed write reg (%08x)...\n",
-			WILC_PIN_MUX_0);
-		return 0;
-	}
+	for (i = 0; (i < 5) && (nint > 0); i++, nint--)
+		ops[1].val |= BIT(27 + i);
 
-	/*
-	 * interrupt enable
-	 */
-	ret = wilc_spi_read_reg(wilc, WILC_INTR_ENABLE, &reg);
-	if (!ret) {
-		dev_err(&spi->dev, "Failed read reg (%08x)...\n",
-			WILC_INTR_ENABLE);
+	for (i = 0; (i < 3) && (nint > 0); i++, nint--)
+		ops[2].val |= BIT(i);
+
+	if (!wilc_spi_batch(wilc, ops, ops[2].val ? 3 : 2)) {
+		dev_err(&spi->dev, "Failed to enable interrupts...\n");
 		return 0;
 	}
 
-	for (i = 0; (i < 5) && (nint > 0); i++, nint--)
-		reg |= (BIT((27 + i)));
+	return 1;
+}
 
-	ret = wilc_spi_write_reg(wilc, WILC_INTR_ENABLE, reg);
-	if (!ret) {
-		dev_err(&spi->dev, "Failed write reg (%08x)...\n",
-			WILC_INTR_ENABLE);
-		return 0;
-	}
-	if (nint) {
-		ret = wilc_spi_read_reg(wilc, WILC_INTR2_ENABLE, &reg);
-		if (!ret) {
-			dev_err(&spi->dev, "Failed read reg (%08x)...\n",
-				WILC_INTR2_ENABLE);
-			return 0;
-		}
+static ssize_t wilc_spi_cal_read(struct file *file, char __user *userbuf,
+				 size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+	struct spi_device *spi = to_spi_device(wilc->dev);
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	char buf[64];
+	int res;
 
-		for (i = 0; (i < 3) && (nint > 0); i++, nint--)
-			reg |= BIT(i);
+	res = scnprintf(buf, sizeof(buf), "%u Hz, %u byte packets\n",
+			spi_priv->speed_hz ? spi_priv->speed_hz :
+			spi->max_speed_hz, spi_priv->pkt_sz);
 
-		ret = wilc_spi_write_reg(wilc, WILC_INTR2_ENABLE, reg);
-		if (!ret) {
-			dev_err(&spi->dev, "Failed write reg (%08x)...\n",
-				WILC_INTR2_ENABLE);
-			return 0;
-		}
-	}
+	return simple_read_from_buffer(userbuf, count, ppos, buf, res);
+}
 
-	return 1;
+/*
+ * writing 1 recalibrates; traffic is held off while it runs. Only allowed
+ * before the firmware is started, as calibration overwrites the VMM table
+ * area the running firmware owns.
+ */
+static ssize_t wilc_spi_cal_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	bool run;
+	int ret;
+
+	ret = kstrtobool_from_user(buf, count, &run);
+	if (ret)
+		return ret;
+
+	if (!run)
+		return count;
+
+	if (!spi_priv->is_init)
+		return -ENODEV;
+
+	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
+	if (wilc->initialized)
+		ret = -EBUSY;
+	else
+		ret = wilc_spi_calibrate(wilc);
+	release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations wilc_spi_cal_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = wilc_spi_cal_read,
+	.write = wilc_spi_cal_write,
+};
+
+static ssize_t wilc_spi_stats_read(struct file *file, char __user *userbuf,
+				   size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+	struct wilc_spi *spi_priv = wilc->bus_data;
+	struct wilc_spi_stats *st = &spi_priv->stats;
+	char buf[256];
+	int res;
+
+	res = scnprintf(buf, sizeof(buf),
+			"bus_err: %u\ncmd_err: %u\ndata_err: %u\ncrc_err: %u\n"
+			"retry: %u\nreset: %u\nslow_reset: %u\ngive_up: %u\n",
+			st->bus_err, st->cmd_err, st->data_err, st->crc_err,
+			st->retry, st->reset, st->slow_reset, st->give_up);
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, res);
+}
+
+/* any write clears the counters */
+static ssize_t wilc_spi_stats_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+	struct wilc_spi *spi_priv = wilc->bus_data;
+
+	memset(&spi_priv->stats, 0, sizeof(spi_priv->stats));
+
+	return count;
+}
+
+static const struct file_operations wilc_spi_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = wilc_spi_stats_read,
+	.write = wilc_spi_stats_write,
+};
+
+#ifdef WILC_HIF_DIRECT
+/* direct bindings for the core, see wilc_hif_read_reg() */
+int wilc_bus_read_reg(struct wilc *wilc, u32 addr, u32 *data)
+{
+	return wilc_spi_read_reg(wilc, addr, data);
+}
+
+int wilc_bus_write_reg(struct wilc *wilc, u32 addr, u32 data)
+{
+	return wilc_spi_write_reg(wilc, addr, data);
+}
+
+int wilc_bus_block_rx(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return wilc_spi_read(wilc, addr, buf, size);
+}
+
+int wilc_bus_block_tx(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return wilc_spi_write(wilc, addr, buf, size);
+}
+
+int wilc_bus_read_int(struct wilc *wilc, u32 *int_status)
+{
+	return wilc_spi_read_int(wilc, int_status);
+}
+
+int wilc_bus_clear_int_ext(struct wilc *wilc, u32 val)
+{
+	return wilc_spi_clear_int_ext(wilc, val);
+}
+
+int wilc_bus_read_size(struct wilc *wilc, u32 *size)
+{
+	return wilc_spi_read_size(wilc, size);
+}
+
+int wilc_bus_block_tx_ext(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return wilc_spi_write(wilc, addr, buf, size);
+}
+
+int wilc_bus_block_rx_ext(struct wilc *wilc, u32 addr, u8 *buf, u32 size)
+{
+	return wilc_spi_read(wilc, addr, buf, size);
 }
+#endif
 
 /* Global spi HIF function table */
 static const struct wilc_hif_func wilc_hif_spi = {
@@ -1233,8 +2331,14 @@ static const struct wilc_hif_func wilc_hif_spi = {
 	.hif_clear_int_ext = wilc_spi_clear_int_ext,
 	.hif_read_size = wilc_spi_read_size,
 	.hif_block_tx_ext = wilc_spi_write,
+	.hif_block_tx_ext_async = wilc_spi_write_async,
 	.hif_block_rx_ext = wilc_spi_read,
 	.hif_sync_ext = wilc_spi_sync_ext,
 	.hif_reset = wilc_spi_reset,
 	.hif_is_init = wilc_spi_is_init,
+	.hif_batch = wilc_spi_batch,
+#ifdef WILC_SPI_PREMAP
+	.hif_dma_map = wilc_spi_dma_map,
+	.hif_dma_unmap = wilc_spi_dma_unmap,
+#endif
 };
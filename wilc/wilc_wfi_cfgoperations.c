@@ -2292,6 +2292,7 @@ static int change_virtual_intf(struct wiphy *wiphy, struct net_device *dev,
 		PRINT_ER(dev, "Unknown interface type= %d\n", type);
 		return -EINVAL;
 	}
+	wilc_rx_demux_update(wl);
 
 	return 0;
 }
@@ -2573,6 +2574,7 @@ static struct wireless_dev *add_virtual_intf(struct wiphy *wiphy,
 			"Setting monitor flag in private structure\n");
 			vif = netdev_priv(priv->wdev->netdev);
 			vif->monitor_flag = 1;
+			wilc_rx_demux_update(vif->wilc);
 		} else {
 			PRINT_ER(vif->ndev,
 				 "Error in initializing monitor interface\n");
@@ -13,6 +13,9 @@
 #include <net/ieee80211_radiotap.h>
 #include <linux/if_arp.h>
 #include <linux/version.h>
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE
+#include <net/xdp.h>
+#endif
 #if KERNEL_VERSION(3, 13, 0) < LINUX_VERSION_CODE
 #include <linux/gpio/consumer.h>
 #else
@@ -156,6 +159,28 @@ struct tcp_ack_filter {
 	bool enabled;
 };
 
+/*
+ * RX demultiplexing table. Data frames are matched on the address at
+ * offset 10 (STA, from the BSSID) or offset 4 (AP, to the BSSID) of the
+ * MAC header; both tables are small open-addressed hashes so the lookup
+ * cost does not depend on the number of interfaces.
+ */
+#define WILC_RX_DEMUX_SLOTS		8
+
+struct wilc_rx_demux_entry {
+	u8 addr[ETH_ALEN];
+	struct wilc_vif *vif;
+};
+
+struct wilc_rx_demux {
+	struct wilc_rx_demux_entry sta[WILC_RX_DEMUX_SLOTS];
+	struct wilc_rx_demux_entry ap[WILC_RX_DEMUX_SLOTS];
+	/* interface in MONITOR_MODE, fallback for unmatched data frames */
+	struct wilc_vif *mon_vif;
+	/* interface with a monitor netdev attached, gets mgmt frames */
+	struct wilc_vif *mgmt_vif;
+};
+
 struct sysfs_attr_group {
 	bool p2p_mode;
 	u8 ant_swtch_mode;
@@ -186,6 +211,10 @@ struct wilc_vif {
 	struct timer_list periodic_rssi;
 	struct tcp_ack_filter ack_filter;
 	bool connecting;
+#ifdef WILC_XDP
+	struct bpf_prog __rcu *xdp_prog;
+	struct xdp_rxq_info xdp_rxq;
+#endif
 };
 
 struct wilc {
@@ -203,6 +232,9 @@ struct wilc {
 	u8 vif_num;
 	struct wilc_vif *vif[NUM_CONCURRENT_IFC];
 	u8 open_ifcs;
+	/* protect rx_demux, rebuilt on bssid and iftype changes */
+	seqlock_t rx_demux_lock;
+	struct wilc_rx_demux rx_demux;
 	/*protect head of transmit queue*/
 	struct mutex txq_add_to_head_cs;
 	/*protect txq_entry_t transmit queue*/
@@ -211,6 +243,8 @@ struct wilc {
 	struct mutex rxq_cs;
 	/* lock to protect hif access */
 	struct mutex hif_cs;
+	/* host-owned registers, under hif_cs */
+	struct wilc_reg_shadow reg_shadow[WILC_REG_SHADOW_MAX];
 
 	struct completion cfg_event;
 	struct completion sync_event;
@@ -229,21 +263,54 @@ struct wilc {
 	u8 *rx_buffer;
 	u32 rx_buffer_offset;
 	u8 *tx_buffer;
+	/* bus wants data transfers padded to this many bytes, 0 if not */
+	u32 block_pad;
+	/* hif_block_tx_ext_async of tx_buffer */
+	struct completion tx_async_done;
+	int tx_async_ret;
 
 	struct txq_handle txq[NQUEUES];
 	int txq_entries;
 
 	struct rxq_entry_t rxq_head;
 
+	/* control-plane RX, see struct wilc_ctrl_rx_entry */
+	struct list_head ctrl_rxq;
+	/*protect ctrl_rxq and ctrl_rxq_len*/
+	spinlock_t ctrl_rxq_lock;
+	int ctrl_rxq_len;
+	/* scan results shed because the queue was full */
+	u32 ctrl_rxq_drops;
+	struct work_struct ctrl_rx_work;
+	struct workqueue_struct *ctrl_rx_wq;
+	struct dentry *ctrl_rxq_dentry;
+
 	const struct firmware *firmware;
 
 	struct device *dev;
 	struct device *dt_dev;
 
 	enum wilc_chip_type chip;
+	const struct wilc_chip_ops *chip_ops;
 
 	uint8_t power_status[DEV_MAX];
 	uint8_t keep_awake[DEV_MAX];
+	/*
+	 * autosleep: the chip is kept awake for sleep_window_ms after the
+	 * last release, growing from sleep_idle_ms up to sleep_idle_max_ms
+	 * while wakeups keep following closely; 0 sleeps at once. All
+	 * under hif_cs.
+	 */
+	struct delayed_work sleep_work;
+	unsigned int sleep_idle_ms;
+	unsigned int sleep_idle_max_ms;
+	unsigned int sleep_window_ms;
+	bool chip_awake;
+	u8 sleep_pending;
+	ktime_t slept_at;
+	struct wilc_sleep_stats sleep_stats;
+	struct dentry *sleep_dentry;
+	struct wilc_bus_arb bus_arb;
 	struct mutex cs;
 	int clients_count;
 	struct workqueue_struct *hif_workqueue;
@@ -7,30 +7,423 @@
 #include <linux/etherdevice.h>
 #include <linux/if_ether.h>
 #include <linux/ip.h>
+#include <linux/debugfs.h>
 
 #include "wilc_wfi_netdevice.h"
 #include "wilc_wlan_cfg.h"
 #include "linux_wlan.h"
 
-#define WAKUP_TRAILS_TIMEOUT		(10000)
+/*
+ * Clock and firmware handshakes: a few back-to-back reads catch the usual
+ * fast case, after that the poll sleeps between reads until the deadline.
+ */
+#define WILC_WAKEUP_SPIN		(8)
+#define WILC_WAKEUP_TIMEOUT_US		(20000)
+#define WILC_FW_IDLE_SPIN		(4)
+#define WILC_FW_IDLE_TIMEOUT_US		(2000)
+#define WILC_POLL_SLEEP_MIN_US		(50)
+#define WILC_POLL_SLEEP_MAX_US		(100)
 
 #if KERNEL_VERSION(3, 12, 21) > LINUX_VERSION_CODE
 #define list_next_entry(pos, member) \
 	list_entry((pos)->member.next, typeof(*(pos)), member)
 #endif
 
-void acquire_bus(struct wilc *wilc, enum bus_acquire acquire, int source)
+/* run a register batch one access at a time, for buses that can't merge */
+int wilc_hif_batch_seq(struct wilc *wilc, struct wilc_reg_op *ops, int n)
 {
+	struct wilc_reg_op *op;
+	u32 reg;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		op = &ops[i];
+		switch (op->type) {
+		case WILC_REG_OP_READ:
+			if (!wilc_hif_read_reg(wilc, op->addr, &op->val))
+				return 0;
+			break;
+
+		case WILC_REG_OP_WRITE:
+			if (!wilc_hif_write_reg(wilc, op->addr, op->val))
+				return 0;
+			break;
+
+		case WILC_REG_OP_RMW:
+			if (!wilc_hif_read_reg(wilc, op->addr, &reg))
+				return 0;
+			reg = (reg & ~op->mask) | op->val;
+			if (!wilc_hif_write_reg(wilc, op->addr, reg))
+				return 0;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Run @n register reads, writes and read-modify-writes in order, with the
+ * bus held. Returns 1 if all of them succeeded, 0 otherwise.
+ */
+int wilc_hif_batch(struct wilc *wilc, struct wilc_reg_op *ops, int n)
+{
+	if (wilc->hif_func->hif_batch)
+		return wilc->hif_func->hif_batch(wilc, ops, n);
+
+	return wilc_hif_batch_seq(wilc, ops, n);
+}
+
+/*
+ * Poll until (reg & mask) == val. Returns 0 on match, -EIO on a bus error
+ * and -ETIMEDOUT once timeout_us has passed.
+ */
+int wilc_poll_reg(struct wilc *wilc, u32 addr, u32 mask, u32 val,
+		  unsigned int spin, unsigned int timeout_us)
+{
+	ktime_t deadline = ktime_add_us(ktime_get(), timeout_us);
+	u32 reg;
+
+	for (;;) {
+		if (!wilc_hif_read_reg(wilc, addr, &reg))
+			return -EIO;
+		if ((reg & mask) == val)
+			return 0;
+		if (ktime_after(ktime_get(), deadline))
+			return -ETIMEDOUT;
+		if (spin)
+			spin--;
+		else
+			usleep_range(WILC_POLL_SLEEP_MIN_US,
+				     WILC_POLL_SLEEP_MAX_US);
+	}
+}
+
+/*
+ * Full wakeup handshake, timed. A wakeup soon after the chip went to sleep
+ * means traffic is steady, so the idle window doubles; a long sleep lets it
+ * shrink back toward the configured base.
+ */
+static void wilc_autosleep_wake(struct wilc *wilc, int source)
+{
+	struct wilc_sleep_stats *st = &wilc->sleep_stats;
+	unsigned int window = wilc->sleep_window_ms;
+	ktime_t start = ktime_get();
+	s64 slept_ms;
+	u32 ns;
+
+	chip_wakeup(wilc, source);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	st->wakeups++;
+	st->wake_ns += ns;
+	st->wake_ns_max = max(st->wake_ns_max, ns);
+	st->wake_hist[min_t(int, fls((ns / NSEC_PER_USEC) >> 4),
+			    WILC_WAKE_HIST_BUCKETS - 1)]++;
+
+	if (!wilc->sleep_idle_ms)
+		return;
+
+	slept_ms = ktime_to_ms(ktime_sub(start, wilc->slept_at));
+	if (slept_ms < window)
+		window = min(window * 2, wilc->sleep_idle_max_ms);
+	else if (slept_ms > 8 * window)
+		window = max(window / 2, wilc->sleep_idle_ms);
+	wilc->sleep_window_ms = window;
+}
+
+static void wilc_autosleep_work(struct work_struct *work)
+{
+	struct wilc *wilc = container_of(to_delayed_work(work), struct wilc,
+					 sleep_work);
+	int source;
+
+	acquire_bus(wilc, ACQUIRE_ONLY, DEV_WIFI);
+	for (source = 0; source < DEV_MAX; source++) {
+		if (wilc->sleep_pending & BIT(source))
+			chip_allow_sleep(wilc, source);
+	}
+	release_bus(wilc, RELEASE_ONLY, DEV_WIFI);
+}
+
+/* a class counts as pending from acquire_bus_prio() until release_bus() */
+static bool wilc_bus_higher_waiting(struct wilc_bus_arb *arb,
+				    enum wilc_bus_prio prio)
+{
+	bool ret = false;
+	int i;
+
+	spin_lock(&arb->lock);
+	for (i = 0; i < prio; i++) {
+		if (arb->pending[i]) {
+			ret = true;
+			break;
+		}
+	}
+	spin_unlock(&arb->lock);
+
+	return ret;
+}
+
+void acquire_bus_prio(struct wilc *wilc, enum bus_acquire acquire, int source,
+		      enum wilc_bus_prio prio)
+{
+	struct wilc_bus_arb *arb = &wilc->bus_arb;
+	struct wilc_bus_stats *st = &arb->stats[prio];
+	ktime_t start = ktime_get();
+	long max_wait = msecs_to_jiffies(WILC_BUS_MAX_WAIT_MS);
+	bool contended, starved = false;
+	u32 ns;
+
+	spin_lock(&arb->lock);
+	arb->pending[prio]++;
+	spin_unlock(&arb->lock);
+
+	/*
+	 * Let higher classes through before competing for hif_cs, but only
+	 * for so long: past WILC_BUS_MAX_WAIT_MS a lower class queues on
+	 * hif_cs anyway so steady WiFi traffic can't starve BT for good.
+	 */
+	contended = wilc_bus_higher_waiting(arb, prio);
+	if (contended)
+		starved = !wait_event_timeout(arb->wq,
+					      !wilc_bus_higher_waiting(arb, prio),
+					      max_wait);
 	mutex_lock(&wilc->hif_cs);
-	if (acquire == ACQUIRE_AND_WAKEUP)
-		chip_wakeup(wilc, source);
+
+	arb->prio = prio;
+	arb->granted_at = ktime_get();
+	ns = ktime_to_ns(ktime_sub(arb->granted_at, start));
+
+	spin_lock(&arb->lock);
+	st->acquires++;
+	if (contended)
+		st->contended++;
+	if (starved)
+		st->starved++;
+	st->wait_ns += ns;
+	st->wait_ns_max = max(st->wait_ns_max, ns);
+	spin_unlock(&arb->lock);
+
+	if (wilc->hif_func->hif_claim_bus)
+		wilc->hif_func->hif_claim_bus(wilc);
+	if (acquire != ACQUIRE_AND_WAKEUP)
+		return;
+
+	/* this session decides when the chip may sleep again */
+	wilc->sleep_pending &= ~BIT(source);
+	if (wilc->chip_awake && wilc->sleep_idle_ms) {
+		wilc->keep_awake[source] = true;
+		wilc->sleep_stats.wake_skips++;
+	} else {
+		wilc_autosleep_wake(wilc, source);
+	}
 }
 
 void release_bus(struct wilc *wilc, enum bus_release release, int source)
 {
-	if (release == RELEASE_ALLOW_SLEEP)
-		chip_allow_sleep(wilc, source);
+	struct wilc_bus_arb *arb = &wilc->bus_arb;
+	u32 ns;
+
+	if (release == RELEASE_ALLOW_SLEEP) {
+		if (wilc->sleep_idle_ms) {
+			wilc->sleep_pending |= BIT(source);
+			mod_delayed_work(system_wq, &wilc->sleep_work,
+					 msecs_to_jiffies(wilc->sleep_window_ms));
+		} else {
+			chip_allow_sleep(wilc, source);
+		}
+	}
+	if (wilc->hif_func->hif_release_bus)
+		wilc->hif_func->hif_release_bus(wilc);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), arb->granted_at));
+	spin_lock(&arb->lock);
+	arb->pending[arb->prio]--;
+	arb->stats[arb->prio].hold_ns_max =
+		max(arb->stats[arb->prio].hold_ns_max, ns);
+	spin_unlock(&arb->lock);
+	mutex_unlock(&wilc->hif_cs);
+	wake_up_all(&arb->wq);
+}
+
+void acquire_bus(struct wilc *wilc, enum bus_acquire acquire, int source)
+{
+	acquire_bus_prio(wilc, acquire, source, source == DEV_BT ?
+			 WILC_BUS_PRIO_BULK : WILC_BUS_PRIO_CTRL);
+}
+
+/* put the chip to sleep now if the idle window is still running */
+void wilc_autosleep_flush(struct wilc *wilc)
+{
+	if (cancel_delayed_work_sync(&wilc->sleep_work))
+		wilc_autosleep_work(&wilc->sleep_work.work);
+}
+
+/* set the idle window, negative values leave a setting as it is */
+void wilc_autosleep_set(struct wilc *wilc, int idle_ms, int max_ms)
+{
+	mutex_lock(&wilc->hif_cs);
+	if (idle_ms >= 0)
+		wilc->sleep_idle_ms = idle_ms;
+	if (max_ms >= 0)
+		wilc->sleep_idle_max_ms = max_ms;
+	wilc->sleep_idle_max_ms = max(wilc->sleep_idle_max_ms,
+				      wilc->sleep_idle_ms);
+	wilc->sleep_window_ms = wilc->sleep_idle_ms;
+	mutex_unlock(&wilc->hif_cs);
+
+	/* with autosleep off nothing may stay pending */
+	if (!idle_ms)
+		wilc_autosleep_flush(wilc);
+}
+
+static ssize_t wilc_autosleep_read(struct file *file, char __user *userbuf,
+				   size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+	struct wilc_sleep_stats st;
+	unsigned int window, base, max_ms;
+	char buf[512];
+	int res, i;
+
+	mutex_lock(&wilc->hif_cs);
+	st = wilc->sleep_stats;
+	window = wilc->sleep_window_ms;
+	base = wilc->sleep_idle_ms;
+	max_ms = wilc->sleep_idle_max_ms;
+	mutex_unlock(&wilc->hif_cs);
+
+	res = scnprintf(buf, sizeof(buf),
+			"window:      %u ms (base %u, max %u)\n"
+			"wakeups:     %u\n"
+			"wake_skips:  %u\n"
+			"sleeps:      %u\n"
+			"wake_avg_us: %llu\n"
+			"wake_max_us: %u\n"
+			"wake_fails:  %u\n"
+			"fw_busy:     %u\n"
+			"wake_hist_us:",
+			window, base, max_ms, st.wakeups, st.wake_skips,
+			st.sleeps,
+			st.wakeups ? div_u64(st.wake_ns, st.wakeups) / 1000 : 0,
+			st.wake_ns_max / 1000, st.wake_fails, st.fw_busy);
+	for (i = 0; i < WILC_WAKE_HIST_BUCKETS - 1; i++)
+		res += scnprintf(buf + res, sizeof(buf) - res, " <%u:%u",
+				 16 << i, st.wake_hist[i]);
+	res += scnprintf(buf + res, sizeof(buf) - res, " >=%u:%u\n",
+			 16 << i, st.wake_hist[i]);
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, res);
+}
+
+/* any write clears the counters */
+static ssize_t wilc_autosleep_write(struct file *file,
+				    const char __user *userbuf,
+				    size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+
+	mutex_lock(&wilc->hif_cs);
+	memset(&wilc->sleep_stats, 0, sizeof(wilc->sleep_stats));
 	mutex_unlock(&wilc->hif_cs);
+
+	return count;
+}
+
+static const struct file_operations wilc_autosleep_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = wilc_autosleep_read,
+	.write = wilc_autosleep_write,
+};
+
+void wilc_autosleep_init(struct wilc *wilc)
+{
+	INIT_DELAYED_WORK(&wilc->sleep_work, wilc_autosleep_work);
+	wilc->sleep_idle_max_ms = WILC_AUTOSLEEP_MAX_MS;
+#if defined(WILC_DEBUGFS)
+	wilc->sleep_dentry = debugfs_create_file("autosleep", 0600,
+						 wilc_debugfs_get_dir(), wilc,
+						 &wilc_autosleep_fops);
+#endif
+}
+
+void wilc_autosleep_deinit(struct wilc *wilc)
+{
+	cancel_delayed_work_sync(&wilc->sleep_work);
+	debugfs_remove(wilc->sleep_dentry);
+	wilc->sleep_dentry = NULL;
+}
+
+static const char * const wilc_bus_prio_names[WILC_BUS_PRIO_MAX] = {
+	"rx", "ctrl", "tx", "bulk"
+};
+
+static ssize_t wilc_bus_arb_read(struct file *file, char __user *userbuf,
+				 size_t count, loff_t *ppos)
+{
+	struct wilc_bus_arb *arb = file->private_data;
+	struct wilc_bus_stats st[WILC_BUS_PRIO_MAX];
+	char buf[512];
+	int res, i;
+
+	spin_lock(&arb->lock);
+	memcpy(st, arb->stats, sizeof(st));
+	spin_unlock(&arb->lock);
+
+	res = scnprintf(buf, sizeof(buf),
+			"class acquires contended starved wait_avg_us wait_max_us hold_max_us\n");
+	for (i = 0; i < WILC_BUS_PRIO_MAX; i++)
+		res += scnprintf(buf + res, sizeof(buf) - res,
+				 "%-5s %8u %9u %7u %11llu %11u %11u\n",
+				 wilc_bus_prio_names[i], st[i].acquires,
+				 st[i].contended, st[i].starved,
+				 st[i].acquires ?
+				 div_u64(st[i].wait_ns, st[i].acquires) / 1000 :
+				 0, st[i].wait_ns_max / 1000,
+				 st[i].hold_ns_max / 1000);
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, res);
+}
+
+/* any write clears the counters */
+static ssize_t wilc_bus_arb_write(struct file *file, const char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	struct wilc_bus_arb *arb = file->private_data;
+
+	spin_lock(&arb->lock);
+	memset(arb->stats, 0, sizeof(arb->stats));
+	spin_unlock(&arb->lock);
+
+	return count;
+}
+
+static const struct file_operations wilc_bus_arb_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = wilc_bus_arb_read,
+	.write = wilc_bus_arb_write,
+};
+
+void wilc_bus_arb_init(struct wilc *wilc)
+{
+	struct wilc_bus_arb *arb = &wilc->bus_arb;
+
+	spin_lock_init(&arb->lock);
+	init_waitqueue_head(&arb->wq);
+#if defined(WILC_DEBUGFS)
+	arb->dentry = debugfs_create_file("bus_arb", 0600,
+					  wilc_debugfs_get_dir(), arb,
+					  &wilc_bus_arb_fops);
+#endif
+}
+
+void wilc_bus_arb_deinit(struct wilc *wilc)
+{
+	debugfs_remove(wilc->bus_arb.dentry);
+	wilc->bus_arb.dentry = NULL;
 }
 
 uint8_t reset_bus(struct wilc *wilc)
@@ -42,6 +435,101 @@ uint8_t reset_bus(struct wilc *wilc)
 	return ret;
 }
 
+/*
+ * Declare the host-owned registers: the wakeup and host-to-fw handshake
+ * registers, read-modify-written on every wakeup and allow-sleep. Their
+ * cached value stands in for a bus read until the chip may have lost it,
+ * see wilc_reg_shadow_invalidate(). Redone by wilc_chip_select() as the
+ * set depends on the chip.
+ */
+void wilc_reg_shadow_init(struct wilc *wilc)
+{
+	struct wilc_reg_shadow *sh = wilc->reg_shadow;
+
+	memset(sh, 0, sizeof(wilc->reg_shadow));
+	if (wilc->io_type == HIF_SDIO ||
+	    wilc->io_type == HIF_SDIO_GPIO_IRQ) {
+		/*
+		 * On WILC3000 0xf0 also carries the clock status bits the
+		 * chip updates, so it can't be shadowed there.
+		 */
+		if (wilc->chip == WILC_3000)
+			sh[0].addr = WILC_REG_SHADOW_NONE;
+		else
+			sh[0].addr = 0xf0;
+		sh[1].addr = 0xfa;
+	} else {
+		sh[0].addr = 0x1;
+		sh[1].addr = 0x0b;
+	}
+}
+
+/* forget cached values, after a power cycle, chip reset or resume */
+void wilc_reg_shadow_invalidate(struct wilc *wilc)
+{
+	int i;
+
+	for (i = 0; i < WILC_REG_SHADOW_MAX; i++)
+		wilc->reg_shadow[i].valid = false;
+}
+
+static struct wilc_reg_shadow *wilc_reg_shadow_find(struct wilc *wilc,
+						    u32 addr)
+{
+	int i;
+
+	for (i = 0; i < WILC_REG_SHADOW_MAX; i++) {
+		if (wilc->reg_shadow[i].addr == addr)
+			return &wilc->reg_shadow[i];
+	}
+
+	return NULL;
+}
+
+/* hif_read_reg, answered from the shadow for host-owned registers */
+int wilc_reg_read(struct wilc *wilc, u32 addr, u32 *val)
+{
+	struct wilc_reg_shadow *sh = wilc_reg_shadow_find(wilc, addr);
+
+	if (sh && sh->valid) {
+		*val = sh->val;
+		return 1;
+	}
+
+	if (!wilc_hif_read_reg(wilc, addr, val))
+		return 0;
+
+	if (sh) {
+		sh->val = *val;
+		sh->valid = true;
+	}
+
+	return 1;
+}
+
+/* hif_write_reg, skipped when a host-owned register already holds @val */
+int wilc_reg_write(struct wilc *wilc, u32 addr, u32 val)
+{
+	struct wilc_reg_shadow *sh = wilc_reg_shadow_find(wilc, addr);
+
+	if (sh && sh->valid && sh->val == val)
+		return 1;
+
+	if (!wilc_hif_write_reg(wilc, addr, val)) {
+		/* the write may or may not have landed */
+		if (sh)
+			sh->valid = false;
+		return 0;
+	}
+
+	if (sh) {
+		sh->val = val;
+		sh->valid = true;
+	}
+
+	return 1;
+}
+
 static void wilc_wlan_txq_remove(struct wilc *wilc, u8 q_num,
 				 struct txq_entry_t *tqe)
 {
@@ -269,30 +757,125 @@ static void wilc_wlan_txq_filter_dup_tcp_ack(struct net_device *dev)
 	}
 }
 
-static struct net_device *get_if_handler(struct wilc *wilc, u8 *mac_header)
+static inline u8 wilc_rx_demux_hash(const u8 *addr)
+{
+	return (addr[4] ^ addr[5]) & (WILC_RX_DEMUX_SLOTS - 1);
+}
+
+static void wilc_rx_demux_insert(struct wilc_rx_demux_entry *tbl,
+				 struct wilc_vif *vif)
+{
+	u8 slot = wilc_rx_demux_hash(vif->bssid);
+	int i;
+
+	if (is_zero_ether_addr(vif->bssid))
+		return;
+
+	for (i = 0; i < WILC_RX_DEMUX_SLOTS; i++) {
+		struct wilc_rx_demux_entry *e;
+
+		e = &tbl[(slot + i) & (WILC_RX_DEMUX_SLOTS - 1)];
+		if (!e->vif) {
+			ether_addr_copy(e->addr, vif->bssid);
+			e->vif = vif;
+			return;
+		}
+	}
+}
+
+static struct wilc_vif *
+wilc_rx_demux_find(const struct wilc_rx_demux_entry *tbl, const u8 *addr)
+{
+	u8 slot = wilc_rx_demux_hash(addr);
+	int i;
+
+	for (i = 0; i < WILC_RX_DEMUX_SLOTS; i++) {
+		const struct wilc_rx_demux_entry *e;
+
+		e = &tbl[(slot + i) & (WILC_RX_DEMUX_SLOTS - 1)];
+		if (!e->vif)
+			return NULL;
+		if (ether_addr_equal_unaligned(addr, e->addr))
+			return e->vif;
+	}
+
+	return NULL;
+}
+
+/*
+ * Rebuild the RX demux table from the current vif state. Must be called
+ * whenever a vif bssid, iftype or monitor_flag changes.
+ */
+void wilc_rx_demux_update(struct wilc *wilc)
 {
-	u8 *bssid, *bssid1;
-	int i = 0;
-	struct net_device *mon_netdev = NULL;
+	struct wilc_rx_demux *dmx = &wilc->rx_demux;
+	struct wilc_vif *vif;
+	int i;
 
-	bssid = mac_header + 10;
-	bssid1 = mac_header + 4;
+	write_seqlock(&wilc->rx_demux_lock);
+	memset(dmx, 0, sizeof(*dmx));
 	for (i = 0; i <= wilc->vif_num; i++) {
-		if (wilc->vif[i]->iftype == STATION_MODE)
-			if (ether_addr_equal_unaligned(bssid,
-						       wilc->vif[i]->bssid))
-				return wilc->vif[i]->ndev;
-		if (wilc->vif[i]->iftype == AP_MODE)
-			if (ether_addr_equal_unaligned(bssid1,
-						       wilc->vif[i]->bssid))
-				return wilc->vif[i]->ndev;
-		if (wilc->vif[i]->iftype == MONITOR_MODE)
-			mon_netdev = wilc->vif[i]->ndev;
-	}
-
-	if (!mon_netdev)
+		vif = wilc->vif[i];
+		if (!vif)
+			continue;
+
+		if (vif->iftype == STATION_MODE)
+			wilc_rx_demux_insert(dmx->sta, vif);
+		else if (vif->iftype == AP_MODE)
+			wilc_rx_demux_insert(dmx->ap, vif);
+		else if (vif->iftype == MONITOR_MODE && !dmx->mon_vif)
+			dmx->mon_vif = vif;
+
+		if (vif->monitor_flag && !dmx->mgmt_vif)
+			dmx->mgmt_vif = vif;
+	}
+	write_sequnlock(&wilc->rx_demux_lock);
+}
+
+struct wilc_vif *wilc_rx_demux_mon_vif(struct wilc *wilc)
+{
+	struct wilc_vif *vif;
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&wilc->rx_demux_lock);
+		vif = wilc->rx_demux.mon_vif;
+	} while (read_seqretry(&wilc->rx_demux_lock, seq));
+
+	return vif;
+}
+
+struct wilc_vif *wilc_rx_demux_mgmt_vif(struct wilc *wilc)
+{
+	struct wilc_vif *vif;
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&wilc->rx_demux_lock);
+		vif = wilc->rx_demux.mgmt_vif;
+	} while (read_seqretry(&wilc->rx_demux_lock, seq));
+
+	return vif;
+}
+
+static struct wilc_vif *get_if_handler(struct wilc *wilc, u8 *mac_header)
+{
+	struct wilc_rx_demux *dmx = &wilc->rx_demux;
+	struct wilc_vif *vif;
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&wilc->rx_demux_lock);
+		vif = wilc_rx_demux_find(dmx->sta, mac_header + 10);
+		if (!vif)
+			vif = wilc_rx_demux_find(dmx->ap, mac_header + 4);
+		if (!vif)
+			vif = dmx->mon_vif;
+	} while (read_seqretry(&wilc->rx_demux_lock, seq));
+
+	if (!vif)
 		PRINT_WRN(wilc->vif[0]->ndev, GENERIC_DBG, "Invalid handle\n");
-	return mon_netdev;
+	return vif;
 }
 
 void wilc_enable_tcp_ack_filter(struct wilc_vif *vif, bool value)
@@ -507,7 +1090,7 @@ int txq_add_net_pkt(struct net_device *dev, void *priv, u8 *buffer,
 		return 0;
 	}
 
-	tqe = kmalloc(sizeof(*tqe), GFP_KERNEL);
+	tqe = kmalloc(sizeof(*tqe), GFP_ATOMIC);
 
 	if (!tqe) {
 		PRINT_INFO(vif->ndev, TX_DBG,
@@ -657,11 +1240,9 @@ static struct rxq_entry_t *rxq_remove(struct wilc *wilc)
 static int chip_allow_sleep_wilc1000(struct wilc *wilc, int source)
 {
 	u32 reg = 0;
-	const struct wilc_hif_func *hif_func = wilc->hif_func;
 	u32 wakeup_reg, wakeup_bit;
 	u32 to_host_from_fw_reg, to_host_from_fw_bit;
 	u32 from_host_to_fw_reg, from_host_to_fw_bit;
-	u32 trials = 100;
 	int ret;
 
 	if (wilc->io_type == HIF_SDIO ||
@@ -681,33 +1262,32 @@ static int chip_allow_sleep_wilc1000(struct wilc *wilc, int source)
 		to_host_from_fw_bit = BIT(0);
 	}
 
-	while (trials--) {
-		ret = hif_func->hif_read_reg(wilc, to_host_from_fw_reg, &reg);
-		if (!ret)
-			return -EIO;
-		if ((reg & to_host_from_fw_bit) == 0)
-			break;
-	}
-	if (!trials)
+	ret = wilc_poll_reg(wilc, to_host_from_fw_reg, to_host_from_fw_bit, 0,
+			    WILC_FW_IDLE_SPIN, WILC_FW_IDLE_TIMEOUT_US);
+	if (ret == -EIO)
+		return ret;
+	if (ret) {
+		wilc->sleep_stats.fw_busy++;
 		pr_warn("FW not responding\n");
+	}
 
 	/* Clear bit 1 */
-	ret = hif_func->hif_read_reg(wilc, wakeup_reg, &reg);
+	ret = wilc_reg_read(wilc, wakeup_reg, &reg);
 	if (!ret)
 		return -EIO;
 	if (reg & wakeup_bit) {
 		reg &= ~wakeup_bit;
-		ret = hif_func->hif_write_reg(wilc, wakeup_reg, reg);
+		ret = wilc_reg_write(wilc, wakeup_reg, reg);
 		if (!ret)
 			return -EIO;
 	}
 
-	ret = hif_func->hif_read_reg(wilc, from_host_to_fw_reg, &reg);
+	ret = wilc_reg_read(wilc, from_host_to_fw_reg, &reg);
 	if (!ret)
 		return -EIO;
 	if (reg & from_host_to_fw_bit) {
 		reg &= ~from_host_to_fw_bit;
-		ret = hif_func->hif_write_reg(wilc, from_host_to_fw_reg, reg);
+		ret = wilc_reg_write(wilc, from_host_to_fw_reg, reg);
 		if (!ret)
 			return -EIO;
 	}
@@ -719,21 +1299,20 @@ static int chip_allow_sleep_wilc3000(struct wilc *wilc, int source)
 {
 	u32 reg = 0;
 	int ret;
-	const struct wilc_hif_func *hif_func = wilc->hif_func;
 
 	if (wilc->io_type == HIF_SDIO ||
 		wilc->io_type == HIF_SDIO_GPIO_IRQ) {
-		ret = hif_func->hif_read_reg(wilc, 0xf0, &reg);
+		ret = wilc_reg_read(wilc, 0xf0, &reg);
 		if (!ret)
 			return -EIO;
-		ret = hif_func->hif_write_reg(wilc, 0xf0, reg & ~BIT(0));
+		ret = wilc_reg_write(wilc, 0xf0, reg & ~BIT(0));
 		if (!ret)
 			return -EIO;
 	} else {
-		ret = hif_func->hif_read_reg(wilc, 0x1, &reg);
+		ret = wilc_reg_read(wilc, 0x1, &reg);
 		if (!ret)
 			return -EIO;
-		ret = hif_func->hif_write_reg(wilc, 0x1, reg & ~BIT(1));
+		ret = wilc_reg_write(wilc, 0x1, reg & ~BIT(1));
 		if (!ret)
 			return -EIO;
 	}
@@ -749,23 +1328,31 @@ void chip_allow_sleep(struct wilc *wilc, int source)
 		pr_warn("Another device is preventing allow sleep operation. request source is %s\n",
 			  (source == DEV_WIFI ? "Wifi" : "BT"));
 	else
-		if (wilc->chip == WILC_1000)
-			ret = chip_allow_sleep_wilc1000(wilc, source);
-		else
-			ret = chip_allow_sleep_wilc3000(wilc, source);
+		ret = wilc->chip_ops->allow_sleep(wilc, source);
 	if (!ret)
 		wilc->keep_awake[source] = false;
+
+	/* on failure assume asleep so the next session does a full wakeup */
+	wilc->sleep_pending &= ~BIT(source);
+	if (wilc->chip_awake) {
+		wilc->chip_awake = !ret && (wilc->keep_awake[DEV_WIFI] ||
+					    wilc->keep_awake[DEV_BT]);
+		if (!wilc->chip_awake) {
+			wilc->sleep_stats.sleeps++;
+			wilc->slept_at = ktime_get();
+		}
+	}
 }
 
-void chip_wakeup_wilc1000(struct wilc *wilc, int source)
+static int chip_wakeup_wilc1000(struct wilc *wilc, int source)
 {
 	u32 ret = 0;
-	u32 reg = 0, clk_status_val = 0, trials = 0;
+	u32 reg = 0;
+	int poll;
 	u32 wakeup_reg, wakeup_bit;
 	u32 clk_status_reg, clk_status_bit;
 	u32 to_host_from_fw_reg, to_host_from_fw_bit;
 	u32 from_host_to_fw_reg, from_host_to_fw_bit;
-	const struct wilc_hif_func *hif_func = wilc->hif_func;
 
 	if (wilc->io_type == HIF_SDIO ||
 		wilc->io_type == HIF_SDIO_GPIO_IRQ) {
@@ -788,75 +1375,69 @@ void chip_wakeup_wilc1000(struct wilc *wilc, int source)
 		to_host_from_fw_bit = BIT(0);
 	}
 
-	ret = hif_func->hif_read_reg(wilc, from_host_to_fw_reg, &reg);
+	ret = wilc_reg_read(wilc, from_host_to_fw_reg, &reg);
 	if (!ret)
 		goto _fail_;
 
 	if (!(reg & from_host_to_fw_bit)) {
 		/*USE bit 0 to indicate host wakeup*/
-		ret = hif_func->hif_write_reg(wilc, from_host_to_fw_reg,
-					      reg | from_host_to_fw_bit);
+		ret = wilc_reg_write(wilc, from_host_to_fw_reg,
+				     reg | from_host_to_fw_bit);
 		if (!ret)
 			goto _fail_;
 	}
 
-	ret = hif_func->hif_read_reg(wilc, wakeup_reg, &reg);
+	ret = wilc_reg_read(wilc, wakeup_reg, &reg);
 	if (!ret)
 		goto _fail_;
 	/* Set bit 1 */
 	if (!(reg & wakeup_bit)) {
-		ret = hif_func->hif_write_reg(wilc, wakeup_reg,
-					      reg | wakeup_bit);
+		ret = wilc_reg_write(wilc, wakeup_reg, reg | wakeup_bit);
 		if (!ret)
 			goto _fail_;
 	}
 
-	do {
-		ret = hif_func->hif_read_reg(wilc, clk_status_reg,
-					     &clk_status_val);
-		if (!ret) {
-			pr_err("Bus error (5).%d %x\n", ret, clk_status_val);
-			goto _fail_;
-		}
-		if (clk_status_val & clk_status_bit)
-			break;
-
-		//nm_bsp_sleep(2);
-		trials++;
-		if (trials > WAKUP_TRAILS_TIMEOUT) {
-			pr_err("Failed to wakup the chip\n");
-			ret = -1;
-			goto _fail_;
-		}
-	} while (1);
+	poll = wilc_poll_reg(wilc, clk_status_reg, clk_status_bit,
+			     clk_status_bit, WILC_WAKEUP_SPIN,
+			     WILC_WAKEUP_TIMEOUT_US);
+	if (poll == -EIO) {
+		pr_err("Bus error (5)\n");
+		return poll;
+	}
+	if (poll) {
+		wilc->sleep_stats.wake_fails++;
+		pr_err("Failed to wakup the chip\n");
+		return poll;
+	}
 
 	if (wilc_get_chipid(wilc, false) < 0x1002b0) {
 		uint32_t val32;
 		/* Enable PALDO back right after wakeup */
-		hif_func->hif_read_reg(wilc, 0x1e1c, &val32);
+		wilc_hif_read_reg(wilc, 0x1e1c, &val32);
 		val32 |= BIT(6);
-		hif_func->hif_write_reg(wilc, 0x1e1c, val32);
+		wilc_hif_write_reg(wilc, 0x1e1c, val32);
 
-		hif_func->hif_read_reg(wilc, 0x1e9c, &val32);
+		wilc_hif_read_reg(wilc, 0x1e9c, &val32);
 		val32 |= BIT(6);
-		hif_func->hif_write_reg(wilc, 0x1e9c, val32);
+		wilc_hif_write_reg(wilc, 0x1e9c, val32);
 	}
 	/*workaround sometimes spi fail to read clock regs after reading
 	 * writing clockless registers
 	 */
 	reset_bus(wilc);
 
+	return 0;
+
 _fail_:
-	return;
+	return -EIO;
 }
 
-void chip_wakeup_wilc3000(struct wilc *wilc, int source)
+static int chip_wakeup_wilc3000(struct wilc *wilc, int source)
 {
 	u32 wakeup_reg_val, clk_status_reg_val, trials = 0;
 	u32 wakeup_reg, wakeup_bit;
 	u32 clk_status_reg, clk_status_bit;
 	int wake_seq_trials = 5;
-	const struct wilc_hif_func *hif_func = wilc->hif_func;
 
 	if (wilc->io_type == HIF_SDIO ||
 		wilc->io_type == HIF_SDIO_GPIO_IRQ) {
@@ -871,13 +1452,12 @@ void chip_wakeup_wilc3000(struct wilc *wilc, int source)
 		clk_status_bit = BIT(2);
 	}
 
-	hif_func->hif_read_reg(wilc, wakeup_reg, &wakeup_reg_val);
+	wilc_reg_read(wilc, wakeup_reg, &wakeup_reg_val);
 	do {
-		hif_func->hif_write_reg(wilc, wakeup_reg, wakeup_reg_val |
-							  wakeup_bit);
+		wilc_reg_write(wilc, wakeup_reg, wakeup_reg_val | wakeup_bit);
 		/* Check the clock status */
-		hif_func->hif_read_reg(wilc, clk_status_reg,
-				       &clk_status_reg_val);
+		wilc_hif_read_reg(wilc, clk_status_reg,
+				  &clk_status_reg_val);
 
 		/*
 		 * in case of clocks off, wait 1ms, and check it again.
@@ -894,8 +1474,8 @@ void chip_wakeup_wilc3000(struct wilc *wilc, int source)
 			 * can be removed later to avoid the bus access
 			 * overhead
 			 */
-			hif_func->hif_read_reg(wilc, clk_status_reg,
-					       &clk_status_reg_val);
+			wilc_hif_read_reg(wilc, clk_status_reg,
+					  &clk_status_reg_val);
 
 		}
 		/* in case of failure, Reset the wakeup bit to introduce a new
@@ -903,45 +1483,145 @@ void chip_wakeup_wilc3000(struct wilc *wilc, int source)
 		 */
 		if ((clk_status_reg_val & clk_status_bit) == 0) {
 			dev_warn(wilc->dev, "clocks still OFF. Retrying\n");
-			hif_func->hif_write_reg(wilc, wakeup_reg,
-						wakeup_reg_val & (~wakeup_bit));
+			wilc_reg_write(wilc, wakeup_reg,
+				       wakeup_reg_val & (~wakeup_bit));
 		}
 	} while (((clk_status_reg_val & clk_status_bit) == 0)
 		 && (wake_seq_trials-- > 0));
-	if (!wake_seq_trials)
-		dev_err(wilc->dev, "clocks still OFF. Wake up failed\n");
 	wilc->keep_awake[source] = true;
+	if ((clk_status_reg_val & clk_status_bit) == 0) {
+		wilc->sleep_stats.wake_fails++;
+		dev_err(wilc->dev, "clocks still OFF. Wake up failed\n");
+		return -ETIMEDOUT;
+	}
+
+	return 0;
 }
 
 void chip_wakeup(struct wilc *wilc, int source)
 {
-	if (wilc->chip == WILC_1000)
-		chip_wakeup_wilc1000(wilc, source);
-	else
-		chip_wakeup_wilc3000(wilc, source);
+	/* on failure the next session retries the full handshake */
+	wilc->chip_awake = !wilc->chip_ops->wakeup(wilc, source);
 }
 
 void host_wakeup_notify(struct wilc *wilc, int source)
 {
 	acquire_bus(wilc, ACQUIRE_ONLY, source);
-	if (wilc->chip == WILC_1000)
-		wilc->hif_func->hif_write_reg(wilc, 0x10b0, 1);
-	else
-		wilc->hif_func->hif_write_reg(wilc, 0x10c0, 1);
+	wilc_hif_write_reg(wilc, wilc->chip_ops->host_wakeup_reg, 1);
 	release_bus(wilc, RELEASE_ONLY, source);
 }
 
 void host_sleep_notify(struct wilc *wilc, int source)
 {
 	acquire_bus(wilc, ACQUIRE_ONLY, source);
-	if (wilc->chip == WILC_1000)
-		wilc->hif_func->hif_write_reg(wilc, 0x10ac, 1);
-	else
-		wilc->hif_func->hif_write_reg(wilc, 0x10bc, 1);
+	wilc_hif_write_reg(wilc, wilc->chip_ops->host_sleep_reg, 1);
 	release_bus(wilc, RELEASE_ONLY, source);
 }
 
 static u8 ac_fw_count[NQUEUES] = {0, 0, 0, 0};
+static void wilc_wlan_txq_complete(struct wilc_vif *vif,
+				   struct list_head *done)
+{
+	struct txq_entry_t *tqe, *tmp;
+
+	list_for_each_entry_safe(tqe, tmp, done, list) {
+		list_del(&tqe->list);
+		tqe->status = 1;
+		if (tqe->tx_complete_func)
+			tqe->tx_complete_func(tqe->priv,
+					      tqe->status);
+		if (tqe->ack_idx != NOT_TCP_ACK &&
+		    tqe->ack_idx < MAX_PENDING_ACKS)
+			vif->ack_filter.pending_acks[tqe->ack_idx].txqe = NULL;
+		kfree(tqe);
+	}
+}
+
+/*
+ * an async block write normally completes within a few ms; past this the
+ * stall is reported, but the message still belongs to the bus until its
+ * completion runs
+ */
+#define WILC_TX_ASYNC_TIMEOUT		msecs_to_jiffies(500)
+
+static void wilc_wlan_tx_async_done(struct wilc *wilc, void *priv, int ret)
+{
+	wilc->tx_async_ret = ret;
+	complete(&wilc->tx_async_done);
+}
+
+/*
+ * Ask the firmware for room for the VMM table just written. Returns 1/0
+ * like the bus ops; the poll budget is shared with the caller through
+ * @timeout so it can tell a silent firmware from a bus error.
+ */
+static int wilc_vmm_request_wilc1000(struct wilc_vif *vif, u32 *reg,
+				     int *entries, int *timeout)
+{
+	struct wilc *wilc = vif->wilc;
+	int ret;
+
+	ret = wilc_hif_write_reg(wilc, WILC_HOST_VMM_CTL, 0x2);
+	if (!ret) {
+		PRINT_ER(vif->ndev, "fail write reg host_vmm_ctl..\n");
+		return ret;
+	}
+
+	do {
+		ret = wilc_hif_read_reg(wilc, WILC_HOST_VMM_CTL, reg);
+		if (!ret)
+			break;
+		if ((*reg >> 2) & 0x1) {
+			*entries = ((*reg >> 3) & 0x3f);
+			break;
+		}
+	} while (--(*timeout));
+
+	return ret;
+}
+
+static int wilc_vmm_request_wilc3000(struct wilc_vif *vif, u32 *reg,
+				     int *entries, int *timeout)
+{
+	struct wilc *wilc = vif->wilc;
+	int ret;
+
+	ret = wilc_hif_write_reg(wilc, WILC_HOST_VMM_CTL, 0);
+	if (!ret) {
+		PRINT_ER(vif->ndev, "fail write reg host_vmm_ctl..\n");
+		return ret;
+	}
+	/* interrupt firmware */
+	ret = wilc_hif_write_reg(wilc, WILC_INTERRUPT_CORTUS_0, 1);
+	if (!ret) {
+		PRINT_ER(vif->ndev,
+			 "fail write reg WILC_INTERRUPT_CORTUS_0..\n");
+		return ret;
+	}
+
+	do {
+		ret = wilc_hif_read_reg(wilc, WILC_INTERRUPT_CORTUS_0, reg);
+		if (!ret) {
+			PRINT_ER(vif->ndev,
+				 "fail read reg WILC_INTERRUPT_CORTUS_0..\n");
+			break;
+		}
+		if (*reg == 0) {
+			// Get the entries
+			ret = wilc_hif_read_reg(wilc, WILC_HOST_VMM_CTL, reg);
+			if (!ret) {
+				PRINT_ER(vif->ndev,
+					 "fail read reg host_vmm_ctl..\n");
+				break;
+			}
+			*entries = ((*reg >> 3) & 0x3f);
+			break;
+		}
+	} while (--(*timeout));
+
+	return ret;
+}
+
 int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 {
 	int i, entries = 0;
@@ -965,6 +1645,7 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 	struct wilc_vif *vif = netdev_priv(dev);
 	struct wilc *wilc = vif->wilc;
 	const struct wilc_hif_func *func;
+	LIST_HEAD(tx_done);
 
 	txb = wilc->tx_buffer;
 	if (!wilc->txq_entries) {
@@ -1051,11 +1732,12 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 	}
 	vmm_table[i] = 0x0;
 
-	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
+	acquire_bus_prio(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI,
+			 WILC_BUS_PRIO_TX);
 	counter = 0;
 	func = wilc->hif_func;
 	do {
-		ret = func->hif_read_reg(wilc, WILC_HOST_TX_CTRL, &reg);
+		ret = wilc_hif_read_reg(wilc, WILC_HOST_TX_CTRL, &reg);
 		if (!ret) {
 			PRINT_ER(vif->ndev, "fail read reg vmm_tbl_entry..\n");
 			break;
@@ -1071,7 +1753,7 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 			counter = 0;
 			PRINT_INFO(vif->ndev, TX_DBG,
 				    "Looping in tx ctrl , force quit\n");
-			ret = func->hif_write_reg(wilc, WILC_HOST_TX_CTRL, 0);
+			ret = wilc_hif_write_reg(wilc, WILC_HOST_TX_CTRL, 0);
 			break;
 		}
 	} while (!wilc->quit);
@@ -1081,82 +1763,19 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 
 	timeout = 200;
 	do {
-		ret = func->hif_block_tx(wilc,
-					 VMM_TBL_RX_SHADOW_BASE,
-					 (u8 *)vmm_table,
-					 ((i + 1) * 4));
+		ret = wilc_hif_block_tx(wilc,
+					VMM_TBL_RX_SHADOW_BASE,
+					(u8 *)vmm_table,
+					((i + 1) * 4));
 		if (!ret) {
 			PRINT_ER(vif->ndev, "ERR block TX of VMM table.\n");
 			break;
 		}
 
-		if (wilc->chip == WILC_1000) {
-			ret = wilc->hif_func->hif_write_reg(wilc,
-							    WILC_HOST_VMM_CTL,
-							    0x2);
-			if (!ret) {
-				PRINT_ER(vif->ndev,
-					  "fail write reg host_vmm_ctl..\n");
-				break;
-			}
-
-			do {
-				ret = func->hif_read_reg(wilc,
-						      WILC_HOST_VMM_CTL,
-						      &reg);
-				if (!ret)
-					break;
-				if ((reg >> 2) & 0x1) {
-					entries = ((reg >> 3) & 0x3f);
-					break;
-				}
-			} while (--timeout);
-		} else {
-			ret = func->hif_write_reg(wilc,
-					      WILC_HOST_VMM_CTL,
-					      0);
-			if (!ret) {
-				PRINT_ER(vif->ndev,
-					  "fail write reg host_vmm_ctl..\n");
-				break;
-			}
-			/* interrupt firmware */
-			ret = func->hif_write_reg(wilc,
-					      WILC_INTERRUPT_CORTUS_0,
-					      1);
-			if (!ret) {
-				PRINT_ER(vif->ndev,
-					  "fail write reg WILC_INTERRUPT_CORTUS_0..\n");
-				break;
-			}
-
-			do {
-				ret = func->hif_read_reg(wilc,
-						      WILC_INTERRUPT_CORTUS_0,
-						      &reg);
-				if (!ret) {
-					PRINT_ER(vif->ndev,
-						  "fail read reg WILC_INTERRUPT_CORTUS_0..\n");
-					break;
-				}
-				if (reg == 0) {
-					// Get the entries
-
-					ret = func->hif_read_reg(wilc,
-							      WILC_HOST_VMM_CTL,
-							      &reg);
-					if (!ret) {
-						PRINT_ER(vif->ndev,
-							  "fail read reg host_vmm_ctl..\n");
-						break;
-					}
-					entries = ((reg >> 3) & 0x3f);
-					break;
-				}
-			} while (--timeout);
-		}
+		ret = wilc->chip_ops->vmm_request(vif, &reg, &entries,
+						  &timeout);
 		if (timeout <= 0) {
-			ret = func->hif_write_reg(wilc, WILC_HOST_VMM_CTL, 0x0);
+			ret = wilc_hif_write_reg(wilc, WILC_HOST_VMM_CTL, 0x0);
 			break;
 		}
 
@@ -1167,14 +1786,14 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 			PRINT_INFO(vif->ndev, TX_DBG,
 				   "no buffer in the chip (reg: %08x), retry later [[ %d, %x ]]\n",
 				   reg, i, vmm_table[i-1]);
-			ret = func->hif_read_reg(wilc, WILC_HOST_TX_CTRL, &reg);
+			ret = wilc_hif_read_reg(wilc, WILC_HOST_TX_CTRL, &reg);
 			if (!ret) {
 				PRINT_ER(vif->ndev,
 					  "fail read reg WILC_HOST_TX_CTRL..\n");
 				break;
 			}
 			reg &= ~BIT(0);
-			ret = func->hif_write_reg(wilc, WILC_HOST_TX_CTRL, reg);
+			ret = wilc_hif_write_reg(wilc, WILC_HOST_TX_CTRL, reg);
 			if (!ret) {
 				PRINT_ER(vif->ndev,
 					  "fail write reg WILC_HOST_TX_CTRL..\n");
@@ -1240,31 +1859,65 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 		       tqe->buffer, tqe->buffer_size);
 		offset += vmm_sz;
 		i++;
-		tqe->status = 1;
-		if (tqe->tx_complete_func)
-			tqe->tx_complete_func(tqe->priv,
-					      tqe->status);
-		if (tqe->ack_idx != NOT_TCP_ACK &&
-		    tqe->ack_idx < MAX_PENDING_ACKS)
-			vif->ack_filter.pending_acks[tqe->ack_idx].txqe = NULL;
-		kfree(tqe);
+		list_add_tail(&tqe->list, &tx_done);
 	} while (--entries);
 	for (i = 0; i < NQUEUES; i++)
 		ac_fw_count[i] += ac_pkt_num_to_chip[i];
 
-	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
+	/* pad up to whole bus blocks, so there is no byte-mode tail */
+	if (wilc->block_pad) {
+		u32 padded = roundup(offset, wilc->block_pad);
+
+		if (padded <= LINUX_TX_SIZE) {
+			memset(&txb[offset], 0, padded - offset);
+			offset = padded;
+		}
+	}
+
+	/*
+	 * With an async bus the packets are completed while their copy is
+	 * on the wire, otherwise before taking the bus as always.
+	 */
+	if (!func->hif_block_tx_ext_async)
+		wilc_wlan_txq_complete(vif, &tx_done);
+
+	acquire_bus_prio(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI,
+			 WILC_BUS_PRIO_TX);
 
-	ret = func->hif_clear_int_ext(wilc, ENABLE_TX_VMM);
+	ret = wilc_hif_clear_int_ext(wilc, ENABLE_TX_VMM);
 	if (!ret) {
 		PRINT_ER(vif->ndev, "fail start tx VMM ...\n");
 		goto out_release_bus;
 	}
 
-	ret = func->hif_block_tx_ext(wilc, 0, txb, offset);
+	ret = 0;
+	reinit_completion(&wilc->tx_async_done);
+	if (func->hif_block_tx_ext_async &&
+	    func->hif_block_tx_ext_async(wilc, 0, txb, offset,
+					 wilc_wlan_tx_async_done, NULL)) {
+		wilc_wlan_txq_complete(vif, &tx_done);
+		if (!wait_for_completion_timeout(&wilc->tx_async_done,
+						 WILC_TX_ASYNC_TIMEOUT)) {
+			PRINT_ER(vif->ndev, "async block tx stalled\n");
+			/*
+			 * txb, the message and its transfers can't be
+			 * touched again before the bus gives them back
+			 */
+			wait_for_completion(&wilc->tx_async_done);
+		}
+		ret = wilc->tx_async_ret;
+		if (!ret)
+			PRINT_WRN(vif->ndev, TX_DBG,
+				  "async block tx failed, retrying\n");
+	}
+
+	if (!ret)
+		ret = wilc_hif_block_tx_ext(wilc, 0, txb, offset);
 	if (!ret)
 		PRINT_ER(vif->ndev, "fail block tx ext...\n");
 
 out_release_bus:
+	wilc_wlan_txq_complete(vif, &tx_done);
 	release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
 	schedule();
 
@@ -1278,6 +1931,161 @@ out:
 	return ret;
 }
 
+static void wilc_wlan_ctrl_rx_handle(struct wilc *wilc, u8 *buff, int size)
+{
+	struct wilc_cfg_rsp rsp;
+
+	cfg_indicate_rx(wilc, buff, size, &rsp);
+	if (rsp.type == WILC_CFG_RSP) {
+		PRINT_INFO(wilc->vif[0]->ndev, RX_DBG,
+			   "cfg_seq %d rsp.seq %d\n",
+			   wilc->cfg_seq_no, rsp.seq_no);
+
+		if (wilc->cfg_seq_no == rsp.seq_no)
+			complete(&wilc->cfg_event);
+	} else if (rsp.type == WILC_CFG_RSP_STATUS) {
+		wilc_mac_indicate(wilc);
+	}
+}
+
+static void wilc_wlan_ctrl_rx_work(struct work_struct *work)
+{
+	struct wilc *wilc = container_of(work, struct wilc, ctrl_rx_work);
+	struct wilc_ctrl_rx_entry *cqe;
+	unsigned long flags;
+
+	do {
+		spin_lock_irqsave(&wilc->ctrl_rxq_lock, flags);
+		cqe = list_first_entry_or_null(&wilc->ctrl_rxq,
+					       struct wilc_ctrl_rx_entry, list);
+		if (cqe) {
+			list_del(&cqe->list);
+			wilc->ctrl_rxq_len--;
+		}
+		spin_unlock_irqrestore(&wilc->ctrl_rxq_lock, flags);
+
+		if (!cqe)
+			break;
+
+		if (!wilc->quit)
+			wilc_wlan_ctrl_rx_handle(wilc, cqe->frame, cqe->size);
+		kfree(cqe);
+	} while (1);
+}
+
+static void wilc_wlan_ctrl_rxq_add(struct wilc *wilc, u8 *buff, int size)
+{
+	struct wilc_ctrl_rx_entry *cqe;
+	unsigned long flags;
+
+	/* scan results are the only control messages we can afford to lose */
+	if (buff[0] == 'N' &&
+	    READ_ONCE(wilc->ctrl_rxq_len) >= WILC_CTRL_RXQ_MAX) {
+		wilc->ctrl_rxq_drops++;
+		return;
+	}
+
+	cqe = kmalloc(sizeof(*cqe) + size, GFP_KERNEL);
+	if (!cqe)
+		return;
+
+	cqe->size = size;
+	memcpy(cqe->frame, buff, size);
+
+	spin_lock_irqsave(&wilc->ctrl_rxq_lock, flags);
+	list_add_tail(&cqe->list, &wilc->ctrl_rxq);
+	wilc->ctrl_rxq_len++;
+	spin_unlock_irqrestore(&wilc->ctrl_rxq_lock, flags);
+
+	queue_work(wilc->ctrl_rx_wq, &wilc->ctrl_rx_work);
+}
+
+static void wilc_wlan_ctrl_rxq_purge(struct wilc *wilc)
+{
+	struct wilc_ctrl_rx_entry *cqe, *tmp;
+	unsigned long flags;
+	LIST_HEAD(purge);
+
+	spin_lock_irqsave(&wilc->ctrl_rxq_lock, flags);
+	list_splice_init(&wilc->ctrl_rxq, &purge);
+	wilc->ctrl_rxq_len = 0;
+	spin_unlock_irqrestore(&wilc->ctrl_rxq_lock, flags);
+
+	list_for_each_entry_safe(cqe, tmp, &purge, list) {
+		list_del(&cqe->list);
+		kfree(cqe);
+	}
+}
+
+static ssize_t wilc_ctrl_rxq_read(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+	char buf[64];
+	int res;
+
+	res = scnprintf(buf, sizeof(buf), "len:   %d\ndrops: %u\n",
+			READ_ONCE(wilc->ctrl_rxq_len),
+			READ_ONCE(wilc->ctrl_rxq_drops));
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, res);
+}
+
+/* any write clears the drop counter */
+static ssize_t wilc_ctrl_rxq_write(struct file *file,
+				   const char __user *userbuf,
+				   size_t count, loff_t *ppos)
+{
+	struct wilc *wilc = file->private_data;
+
+	wilc->ctrl_rxq_drops = 0;
+
+	return count;
+}
+
+static const struct file_operations wilc_ctrl_rxq_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = wilc_ctrl_rxq_read,
+	.write = wilc_ctrl_rxq_write,
+};
+
+int wilc_wlan_ctrl_rx_init(struct wilc *wilc)
+{
+	INIT_LIST_HEAD(&wilc->ctrl_rxq);
+	spin_lock_init(&wilc->ctrl_rxq_lock);
+	wilc->ctrl_rxq_len = 0;
+	INIT_WORK(&wilc->ctrl_rx_work, wilc_wlan_ctrl_rx_work);
+
+	/*
+	 * Must not share hif_workqueue: its work items block on cfg_event,
+	 * which is completed from here.
+	 */
+	wilc->ctrl_rx_wq = create_singlethread_workqueue("WILC_ctrl_rx_wq");
+	if (!wilc->ctrl_rx_wq)
+		return -ENOMEM;
+
+#if defined(WILC_DEBUGFS)
+	wilc->ctrl_rxq_dentry = debugfs_create_file("ctrl_rxq", 0600,
+						    wilc_debugfs_get_dir(),
+						    wilc, &wilc_ctrl_rxq_fops);
+#endif
+	return 0;
+}
+
+void wilc_wlan_ctrl_rx_deinit(struct wilc *wilc)
+{
+	if (!wilc->ctrl_rx_wq)
+		return;
+
+	debugfs_remove(wilc->ctrl_rxq_dentry);
+	wilc->ctrl_rxq_dentry = NULL;
+	cancel_work_sync(&wilc->ctrl_rx_work);
+	destroy_workqueue(wilc->ctrl_rx_wq);
+	wilc->ctrl_rx_wq = NULL;
+	wilc_wlan_ctrl_rxq_purge(wilc);
+}
+
 static void wilc_wlan_handle_rx_buff(struct wilc *wilc, u8 *buffer, int size)
 {
 	int offset = 0;
@@ -1286,6 +2094,11 @@ static void wilc_wlan_handle_rx_buff(struct wilc *wilc, u8 *buffer, int size)
 	int is_cfg_packet;
 	u8 *buff_ptr;
 	struct wilc_vif *vif = wilc->vif[0];
+	struct sk_buff_head rx_list[NUM_CONCURRENT_IFC];
+	int i;
+
+	for (i = 0; i < NUM_CONCURRENT_IFC; i++)
+		__skb_queue_head_init(&rx_list[i]);
 
 	do {
 		PRINT_INFO(vif->ndev, RX_DBG, "Handling rx buffer\n");
@@ -1308,22 +2121,8 @@ static void wilc_wlan_handle_rx_buff(struct wilc *wilc, u8 *buffer, int size)
 		}
 
 		if (is_cfg_packet) {
-			struct wilc_cfg_rsp rsp;
-
 			buff_ptr += pkt_offset;
-
-			cfg_indicate_rx(wilc, buff_ptr, pkt_len,
-					&rsp);
-			if (rsp.type == WILC_CFG_RSP) {
-				PRINT_INFO(vif->ndev, RX_DBG,
-					"cfg_seq %d rsp.seq %d\n",
-					wilc->cfg_seq_no, rsp.seq_no);
-
-				if (wilc->cfg_seq_no == rsp.seq_no)
-					complete(&wilc->cfg_event);
-			} else if (rsp.type == WILC_CFG_RSP_STATUS) {
-				wilc_mac_indicate(wilc);
-			}
+			wilc_wlan_ctrl_rxq_add(wilc, buff_ptr, pkt_len);
 		} else if (pkt_offset & IS_MANAGMEMENT) {
 			pkt_offset &= ~(IS_MANAGMEMENT |
 					IS_MANAGMEMENT_CALLBACK |
@@ -1335,25 +2134,28 @@ static void wilc_wlan_handle_rx_buff(struct wilc *wilc, u8 *buffer, int size)
 			buff_ptr += HOST_HDR_OFFSET;
 			wilc_wfi_handle_monitor_rx(wilc, buff_ptr, pkt_len);
 		} else if (pkt_len > 0) {
-			struct net_device *wilc_netdev;
+			struct wilc_vif *rx_vif;
 
-			wilc_netdev = get_if_handler(wilc, buff_ptr);
-			if (!wilc_netdev) {
+			rx_vif = get_if_handler(wilc, buff_ptr);
+			if (!rx_vif) {
 				PRINT_ER(vif->ndev,
 					 "wilc_netdev in wilc is NULL");
-				return;
+				break;
 			}
-			vif = netdev_priv(wilc_netdev);
-			wilc_frmw_to_linux(vif, buff_ptr,
-					pkt_len,
-					pkt_offset,
-					PKT_STATUS_NEW);
+			wilc_frmw_to_linux_list(rx_vif, buff_ptr,
+						pkt_len,
+						pkt_offset,
+						&rx_list[rx_vif->idx]);
 		}
 
 		offset += tp_len;
 		if (offset >= size)
 			break;
 	} while (1);
+
+	/* hand every interface its frames from this chunk in one go */
+	for (i = 0; i < NUM_CONCURRENT_IFC; i++)
+		wilc_rx_list_deliver(&rx_list[i]);
 }
 
 static void wilc_wlan_handle_rxq(struct wilc *wilc)
@@ -1393,14 +2195,14 @@ static void wilc_wlan_handle_rxq(struct wilc *wilc)
 
 static void wilc_unknown_isr_ext(struct wilc *wilc)
 {
-	wilc->hif_func->hif_clear_int_ext(wilc, 0);
+	wilc_hif_clear_int_ext(wilc, 0);
 }
 
 static void wilc_wlan_handle_isr_ext(struct wilc *wilc, u32 int_status)
 {
 	u32 offset = wilc->rx_buffer_offset;
 	u8 *buffer = NULL;
-	u32 size;
+	u32 size, xfer_size;
 	u32 retries = 0;
 	int ret = 0;
 	struct rxq_entry_t *rqe;
@@ -1411,7 +2213,7 @@ static void wilc_wlan_handle_isr_ext(struct wilc *wilc, u32 int_status)
 	while (!size && retries < 10) {
 		PRINT_ER(vif->ndev,
 			 "RX Size equal zero Trying to read it again\n");
-		wilc->hif_func->hif_read_size(wilc, &size);
+		wilc_hif_read_size(wilc, &size);
 		size = (size & 0x7fff) << 2;
 		retries++;
 	}
@@ -1419,20 +2221,25 @@ static void wilc_wlan_handle_isr_ext(struct wilc *wilc, u32 int_status)
 	if (size <= 0)
 		return;
 
-	if (LINUX_RX_SIZE - offset < size)
+	/* read whole bus blocks, the padding is dropped with the chunk */
+	xfer_size = size;
+	if (wilc->block_pad)
+		xfer_size = roundup(size, wilc->block_pad);
+
+	if (LINUX_RX_SIZE - offset < xfer_size)
 		offset = 0;
 
 	buffer = &wilc->rx_buffer[offset];
 
-	wilc->hif_func->hif_clear_int_ext(wilc, DATA_INT_CLR | ENABLE_RX_VMM);
+	wilc_hif_clear_int_ext(wilc, DATA_INT_CLR | ENABLE_RX_VMM);
 
-	ret = wilc->hif_func->hif_block_rx_ext(wilc, 0, buffer, size);
+	ret = wilc_hif_block_rx_ext(wilc, 0, buffer, xfer_size);
 	if (!ret) {
 		PRINT_ER(vif->ndev, "fail block rx\n");
 		return;
 	}
 
-	offset += size;
+	offset += xfer_size;
 	wilc->rx_buffer_offset = offset;
 	rqe = kmalloc(sizeof(*rqe), GFP_KERNEL);
 	if (!rqe)
@@ -1452,8 +2259,9 @@ void wilc_handle_isr(struct wilc *wilc)
 	u32 int_status;
 	struct wilc_vif *vif = wilc->vif[0];
 
-	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
-	wilc->hif_func->hif_read_int(wilc, &int_status);
+	acquire_bus_prio(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI,
+			 WILC_BUS_PRIO_RX);
+	wilc_hif_read_int(wilc, &int_status);
 
 	if (int_status & DATA_INT_EXT)
 		wilc_wlan_handle_isr_ext(wilc, int_status);
@@ -1492,10 +2300,10 @@ int wilc_wlan_firmware_download(struct wilc *wilc, const u8 *buffer,
 
 	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
 
-	wilc->hif_func->hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
+	wilc_hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
 	reg &= ~(1ul << 10);
-	ret = wilc->hif_func->hif_write_reg(wilc, WILC_GLB_RESET_0, reg);
-	wilc->hif_func->hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
+	ret = wilc_hif_write_reg(wilc, WILC_GLB_RESET_0, reg);
+	wilc_hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
 	if ((reg & (1ul << 10)) != 0)
 		PRINT_ER(vif->ndev, "Failed to reset Wifi CPU\n");
 
@@ -1505,7 +2313,12 @@ int wilc_wlan_firmware_download(struct wilc *wilc, const u8 *buffer,
 		memcpy(&size, &buffer[offset + 4], 4);
 		le32_to_cpus(&addr);
 		le32_to_cpus(&size);
-		acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
+		/*
+		 * the bus is held for one section at a time, waiting higher
+		 * classes get it in between
+		 */
+		acquire_bus_prio(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI,
+				 WILC_BUS_PRIO_BULK);
 		offset += 8;
 		while (((int)size) && (offset < buffer_size)) {
 			if (size <= blksz)
@@ -1514,8 +2327,8 @@ int wilc_wlan_firmware_download(struct wilc *wilc, const u8 *buffer,
 				size2 = blksz;
 
 			memcpy(dma_buffer, &buffer[offset], size2);
-			ret = wilc->hif_func->hif_block_tx(wilc, addr,
-							   dma_buffer, size2);
+			ret = wilc_hif_block_tx(wilc, addr,
+						dma_buffer, size2);
 			if (!ret)
 				break;
 
@@ -1545,6 +2358,10 @@ int wilc_wlan_start(struct wilc *wilc)
 	u32 reg = 0;
 	int ret;
 	struct wilc_vif *vif = wilc->vif[0];
+	struct wilc_reg_op ops[] = {
+		WILC_REG_WRITE(WILC_VMM_CORE_CFG, 0),
+		WILC_REG_WRITE(WILC_GP_REG_1, 0),
+	};
 
 	if (wilc->io_type == HIF_SDIO ||
 	    wilc->io_type == HIF_SDIO_GPIO_IRQ)
@@ -1552,25 +2369,21 @@ int wilc_wlan_start(struct wilc *wilc)
 	else if (wilc->io_type == HIF_SPI)
 		reg = 1;
 
-	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
-	ret = wilc->hif_func->hif_write_reg(wilc, WILC_VMM_CORE_CFG, reg);
-	if (!ret) {
-		PRINT_ER(vif->ndev,
-			 "[wilc start]: fail write reg vmm_core_cfg...\n");
-		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
-		return -EIO;
-	}
+	ops[0].val = reg;
+
 	reg = 0;
 	if (wilc->io_type == HIF_SDIO_GPIO_IRQ)
 		reg |= WILC_HAVE_SDIO_IRQ_GPIO;
 
-	if (wilc->chip == WILC_3000)
-		reg |= WILC_HAVE_SLEEP_CLK_SRC_RTC;
+	reg |= wilc->chip_ops->start_flags;
+
+	ops[1].val = reg;
 
-	ret = wilc->hif_func->hif_write_reg(wilc, WILC_GP_REG_1, reg);
+	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
+	ret = wilc_hif_batch(wilc, ops, ARRAY_SIZE(ops));
 	if (!ret) {
 		PRINT_ER(vif->ndev,
-			 "[wilc start]: fail write WILC_GP_REG_1...\n");
+			 "[wilc start]: fail write vmm_core_cfg/GP_REG_1...\n");
 		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
 		return -EIO;
 	}
@@ -1578,16 +2391,18 @@ int wilc_wlan_start(struct wilc *wilc)
 	wilc->hif_func->hif_sync_ext(wilc, NUM_INT_EXT);
 
 
-	wilc->hif_func->hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
+	wilc_hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
 	if ((reg & BIT(10)) == BIT(10)) {
 		reg &= ~BIT(10);
-		wilc->hif_func->hif_write_reg(wilc, WILC_GLB_RESET_0, reg);
-		wilc->hif_func->hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
+		wilc_hif_write_reg(wilc, WILC_GLB_RESET_0, reg);
+		wilc_hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
 	}
 
 	reg |= BIT(10);
-	ret = wilc->hif_func->hif_write_reg(wilc, WILC_GLB_RESET_0, reg);
-	wilc->hif_func->hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
+	ret = wilc_hif_write_reg(wilc, WILC_GLB_RESET_0, reg);
+	wilc_hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
+	/* the firmware starts up and may take over the handshake registers */
+	wilc_reg_shadow_invalidate(wilc);
 
 	if (ret >= 0)
 		wilc->initialized = 1;
@@ -1604,61 +2419,29 @@ int wilc_wlan_stop(struct wilc *wilc)
 	int ret;
 	u8 timeout = 10;
 	struct wilc_vif *vif = wilc->vif[0];
+	struct wilc_reg_op ops[] = {
+		/* Clear Wifi mode*/
+		WILC_REG_RMW(GLOBAL_MODE_CONTROL, BIT(0), 0),
+		/*
+		 * Configure the power sequencer to ignore WIFI sleep signal on
+		 * making chip sleep decision
+		 */
+		WILC_REG_RMW(PWR_SEQ_MISC_CTRL, BIT(28), 0),
+		WILC_REG_RMW(WILC_GLB_RESET_0, BIT(10), 0),
+	};
 
 	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, DEV_WIFI);
 
-	/* Clear Wifi mode*/
-	ret = wilc->hif_func->hif_read_reg(wilc, GLOBAL_MODE_CONTROL, &reg);
-	if (!ret) {
-		PRINT_ER(vif->ndev, "Error while reading reg\n");
-		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
-		return ret;
-	}
-
-	reg &= ~BIT(0);
-	ret = wilc->hif_func->hif_write_reg(wilc, GLOBAL_MODE_CONTROL, reg);
-	if (!ret) {
-		PRINT_ER(vif->ndev, "Error while writing reg\n");
-		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
-		return ret;
-	}
-
-	/* Configure the power sequencer to ignore WIFI sleep signal on making
-	 * chip sleep decision
-	 */
-	ret = wilc->hif_func->hif_read_reg(wilc, PWR_SEQ_MISC_CTRL, &reg);
-	if (!ret) {
-		PRINT_ER(vif->ndev, "Error while reading reg\n");
-		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
-		return ret;
-	}
-
-	reg &= ~BIT(28);
-	ret = wilc->hif_func->hif_write_reg(wilc, PWR_SEQ_MISC_CTRL, reg);
-	if (!ret) {
-		PRINT_ER(vif->ndev, "Error while writing reg\n");
-		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
-		return ret;
-	}
-
-	ret = wilc->hif_func->hif_read_reg(wilc, WILC_GLB_RESET_0, &reg);
+	ret = wilc_hif_batch(wilc, ops, ARRAY_SIZE(ops));
 	if (!ret) {
-		PRINT_ER(vif->ndev, "Error while reading reg\n");
-		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
-		return ret;
-	}
-
-	reg &= ~BIT(10);
-	ret = wilc->hif_func->hif_write_reg(wilc, WILC_GLB_RESET_0, reg);
-	if (!ret) {
-		PRINT_ER(vif->ndev, "Error while writing reg\n");
+		PRINT_ER(vif->ndev, "Error while stopping the chip\n");
 		release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
 		return ret;
 	}
 
 	do {
-		ret = wilc->hif_func->hif_read_reg(wilc,
-						   WILC_GLB_RESET_0, &reg);
+		ret = wilc_hif_read_reg(wilc,
+					WILC_GLB_RESET_0, &reg);
 		if (!ret) {
 			PRINT_ER(vif->ndev, "Error while reading reg\n");
 			release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
@@ -1670,16 +2453,16 @@ int wilc_wlan_stop(struct wilc *wilc)
 			PRINT_INFO(vif->ndev, GENERIC_DBG,
 				   "Bit 10 not reset : Retry %d\n", timeout);
 			reg &= ~BIT(10);
-			ret = wilc->hif_func->hif_write_reg(wilc,
-							    WILC_GLB_RESET_0,
-							    reg);
+			ret = wilc_hif_write_reg(wilc,
+						 WILC_GLB_RESET_0,
+						 reg);
 			timeout--;
 		} else {
 			PRINT_INFO(vif->ndev, GENERIC_DBG,
 				   "Bit 10 reset after : Retry %d\n", timeout);
-			ret = wilc->hif_func->hif_read_reg(wilc,
-							   WILC_GLB_RESET_0,
-							   &reg);
+			ret = wilc_hif_read_reg(wilc,
+						WILC_GLB_RESET_0,
+						&reg);
 			if (!ret) {
 				PRINT_ER(vif->ndev, "Error reading reg\n");
 				release_bus(wilc, RELEASE_ALLOW_SLEEP,
@@ -1693,19 +2476,12 @@ int wilc_wlan_stop(struct wilc *wilc)
 		}
 
 	} while (timeout);
+	wilc_reg_shadow_invalidate(wilc);
 
-	if (wilc->chip == WILC_1000) {
-		reg = (BIT(0) | BIT(1) | BIT(2) | BIT(3) | BIT(8) | BIT(9) |
-		       BIT(26) | BIT(29) | BIT(30) | BIT(31));
-	} else {
-		reg = (BIT(0) | BIT(2) | BIT(3) | BIT(8) | BIT(9) |
-		       BIT(20) | BIT(26) | BIT(29) | BIT(30) | BIT(31));
-	}
-
-	wilc->hif_func->hif_read_reg(wilc, WILC_FW_HOST_COMM, &reg);
+	wilc_hif_read_reg(wilc, WILC_FW_HOST_COMM, &reg);
 	reg = BIT(0);
 
-	ret = wilc->hif_func->hif_write_reg(wilc, WILC_FW_HOST_COMM, reg);
+	ret = wilc_hif_write_reg(wilc, WILC_FW_HOST_COMM, reg);
 
 	release_bus(wilc, RELEASE_ALLOW_SLEEP, DEV_WIFI);
 
@@ -1721,6 +2497,7 @@ void wilc_wlan_cleanup(struct net_device *dev)
 	struct wilc *wilc = vif->wilc;
 
 	wilc->quit = 1;
+	wilc_autosleep_flush(wilc);
 	for (ac = 0; ac < NQUEUES; ac++) {
 		do {
 			tqe = wilc_wlan_txq_remove_from_head(dev, ac);
@@ -1739,6 +2516,16 @@ void wilc_wlan_cleanup(struct net_device *dev)
 		kfree(rqe);
 	} while (1);
 
+	if (wilc->ctrl_rx_wq)
+		flush_workqueue(wilc->ctrl_rx_wq);
+	wilc_wlan_ctrl_rxq_purge(wilc);
+
+	if (wilc->hif_func->hif_dma_unmap) {
+		acquire_bus(wilc, ACQUIRE_ONLY, DEV_WIFI);
+		wilc->hif_func->hif_dma_unmap(wilc);
+		release_bus(wilc, RELEASE_ONLY, DEV_WIFI);
+	}
+
 	kfree(wilc->rx_buffer);
 	wilc->rx_buffer = NULL;
 	kfree(wilc->tx_buffer);
@@ -1920,29 +2707,29 @@ static u32 init_chip(struct net_device *dev)
 
 	chipid = wilc_get_chipid(wilc, true);
 
-	ret = wilc->hif_func->hif_read_reg(wilc, 0x1118, &reg);
+	ret = wilc_hif_read_reg(wilc, 0x1118, &reg);
 	if (!ret) {
 		PRINT_ER(vif->ndev, "fail read reg 0x1118\n");
 		goto end;
 	}
 
 	reg |= BIT(0);
-	ret = wilc->hif_func->hif_write_reg(wilc, 0x1118, reg);
+	ret = wilc_hif_write_reg(wilc, 0x1118, reg);
 	if (!ret) {
 		PRINT_ER(vif->ndev, "fail write reg 0x1118\n");
 		goto end;
 	}
-	ret = wilc->hif_func->hif_write_reg(wilc, 0xc0000, 0x71);
+	ret = wilc_hif_write_reg(wilc, 0xc0000, 0x71);
 	if (!ret) {
 		PRINT_ER(vif->ndev, "fail write reg 0xc0000 ...\n");
 		goto end;
 	}
 
 	if (wilc->chip == WILC_3000) {
-		ret = wilc->hif_func->hif_read_reg(wilc, 0x207ac, &reg);
+		ret = wilc_hif_read_reg(wilc, 0x207ac, &reg);
 		PRINT_INFO(vif->ndev, INIT_DBG, "Bootrom sts = %x\n", reg);
-		ret = wilc->hif_func->hif_write_reg(wilc, 0x4f0000,
-						    0x71);
+		ret = wilc_hif_write_reg(wilc, 0x4f0000,
+					 0x71);
 		if (!ret) {
 			PRINT_ER(vif->ndev, "fail write reg 0x4f0000 ...\n");
 			goto end;
@@ -1955,6 +2742,50 @@ end:
 	return ret;
 }
 
+const struct wilc_chip_ops wilc1000_ops = {
+	.type = WILC_1000,
+	.vmm_request = wilc_vmm_request_wilc1000,
+	.wakeup = chip_wakeup_wilc1000,
+	.allow_sleep = chip_allow_sleep_wilc1000,
+	.host_wakeup_reg = 0x10b0,
+	.host_sleep_reg = 0x10ac,
+	.sdio_irq_flags_reg = 0xf7,
+	.sdio_irq_flags_mask = 0x1f,
+	.sdio_irq_clear_reg = 0xf8,
+	.sdio_vmm_reg = 0xf8,
+	.sdio_vmm_shift = 5,
+};
+
+const struct wilc_chip_ops wilc3000_ops = {
+	.type = WILC_3000,
+	.vmm_request = wilc_vmm_request_wilc3000,
+	.wakeup = chip_wakeup_wilc3000,
+	.allow_sleep = chip_allow_sleep_wilc3000,
+	.host_wakeup_reg = 0x10c0,
+	.host_sleep_reg = 0x10bc,
+	.start_flags = WILC_HAVE_SLEEP_CLK_SRC_RTC,
+	.sdio_irq_flags_reg = 0xfe,
+	.sdio_irq_flags_mask = 0x0f,
+	.sdio_irq_clear_reg = 0xfe,
+	.sdio_vmm_reg = 0xf1,
+	.sdio_vmm_shift = 0,
+};
+
+/* bind the chip specific ops for @chipid, done once by the bus init */
+int wilc_chip_select(struct wilc *wilc, u32 chipid)
+{
+	if (is_wilc3000(chipid))
+		wilc->chip_ops = &wilc3000_ops;
+	else if (is_wilc1000(chipid))
+		wilc->chip_ops = &wilc1000_ops;
+	else
+		return -ENODEV;
+
+	wilc->chip = wilc->chip_ops->type;
+	wilc_reg_shadow_init(wilc);
+	return 0;
+}
+
 u32 wilc_get_chipid(struct wilc *wilc, bool update)
 {
 	static u32 chipid;
@@ -1962,13 +2793,13 @@ u32 wilc_get_chipid(struct wilc *wilc, bool update)
 	u32 tempchipid = 0;
 
 	if (chipid == 0 || update) {
-		ret = wilc->hif_func->hif_read_reg(wilc, 0x3b0000,
-						     &tempchipid);
+		ret = wilc_hif_read_reg(wilc, 0x3b0000,
+					&tempchipid);
 		if (!ret)
 			pr_err("[wilc start]: fail read reg 0x3b0000\n");
 		if (!is_wilc3000(tempchipid)) {
-			wilc->hif_func->hif_read_reg(wilc, 0x1000,
-						     &tempchipid);
+			wilc_hif_read_reg(wilc, 0x1000,
+					  &tempchipid);
 			if (!is_wilc1000(tempchipid)) {
 				chipid = 0;
 				return chipid;
@@ -2006,6 +2837,7 @@ int wilc_wlan_init(struct net_device *dev)
 		}
 		release_bus(wilc, RELEASE_ONLY, DEV_WIFI);
 	}
+	wilc_reg_shadow_invalidate(wilc);
 
 	if (!wilc->tx_buffer)
 		wilc->tx_buffer = kmalloc(LINUX_TX_SIZE, GFP_KERNEL);
@@ -2025,6 +2857,12 @@ int wilc_wlan_init(struct net_device *dev)
 		goto fail;
 	}
 
+	if (wilc->hif_func->hif_dma_map) {
+		acquire_bus(wilc, ACQUIRE_ONLY, DEV_WIFI);
+		wilc->hif_func->hif_dma_map(wilc);
+		release_bus(wilc, RELEASE_ONLY, DEV_WIFI);
+	}
+
 	if (!init_chip(dev)) {
 		ret = -EIO;
 		goto fail;
@@ -2033,6 +2871,11 @@ int wilc_wlan_init(struct net_device *dev)
 	return 1;
 
 fail:
+	if (wilc->hif_func->hif_dma_unmap) {
+		acquire_bus(wilc, ACQUIRE_ONLY, DEV_WIFI);
+		wilc->hif_func->hif_dma_unmap(wilc);
+		release_bus(wilc, RELEASE_ONLY, DEV_WIFI);
+	}
 
 	kfree(wilc->rx_buffer);
 	wilc->rx_buffer = NULL;
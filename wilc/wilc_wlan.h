@@ -262,6 +262,19 @@ struct rxq_entry_t {
 	int buffer_size;
 };
 
+/*
+ * Config responses, info and network-info messages are copied out of the
+ * RX buffer and handled by a dedicated worker, away from the data path.
+ * Only 'N' messages are shed once the queue is full.
+ */
+#define WILC_CTRL_RXQ_MAX	64
+
+struct wilc_ctrl_rx_entry {
+	struct list_head list;
+	int size;
+	u8 frame[];
+};
+
 enum wilc_chip_type {
 	WILC_1000,
 	WILC_3000,
@@ -273,6 +286,121 @@ enum wilc_chip_type {
  *
  ********************************************/
 struct wilc;
+struct wilc_vif;
+
+/*
+ * Chip specific parts of the core, bound once by wilc_chip_select() when
+ * the bus reads the chip id so the hot paths don't branch on the chip.
+ */
+struct wilc_chip_ops {
+	enum wilc_chip_type type;
+	/* ask the firmware for room for the VMM table, returns 1/0 */
+	int (*vmm_request)(struct wilc_vif *vif, u32 *reg, int *entries,
+			   int *timeout);
+	/* returns 0 once the chip clocks are up */
+	int (*wakeup)(struct wilc *wilc, int source);
+	int (*allow_sleep)(struct wilc *wilc, int source);
+	u32 host_wakeup_reg;
+	u32 host_sleep_reg;
+	/* extra WILC_HAVE_* flags handed to the firmware on start */
+	u32 start_flags;
+	/* SDIO function 0 interrupt registers */
+	u8 sdio_irq_flags_reg;		/* pending flags, GPIO irq mode */
+	u8 sdio_irq_flags_mask;
+	u8 sdio_irq_clear_reg;		/* flags are cleared here */
+	u8 sdio_vmm_reg;		/* VMM table select and enable */
+	u8 sdio_vmm_shift;
+};
+
+enum wilc_reg_op_type {
+	WILC_REG_OP_READ,
+	WILC_REG_OP_WRITE,
+	WILC_REG_OP_RMW,
+};
+
+/*
+ * One register access of a hif_batch. A read returns the register in @val,
+ * a read-modify-write stores (old & ~@mask) | @val.
+ */
+struct wilc_reg_op {
+	u8 type;
+	u32 addr;
+	u32 mask;
+	u32 val;
+};
+
+#define WILC_REG_READ(a)	{ .type = WILC_REG_OP_READ, .addr = (a) }
+#define WILC_REG_WRITE(a, v)	{ .type = WILC_REG_OP_WRITE, .addr = (a), \
+				  .val = (v) }
+#define WILC_REG_RMW(a, m, v)	{ .type = WILC_REG_OP_RMW, .addr = (a), \
+				  .mask = (m), .val = (v) }
+
+/* last value of a register only the host writes, see wilc_reg_read() */
+struct wilc_reg_shadow {
+	u32 addr;
+	u32 val;
+	bool valid;
+};
+
+#define WILC_REG_SHADOW_MAX	2
+#define WILC_REG_SHADOW_NONE	0xffffffff	/* unused slot */
+
+/* chip wakeup/sleep accounting, see acquire_bus() */
+#define WILC_WAKE_HIST_BUCKETS	10
+
+struct wilc_sleep_stats {
+	u32 wakeups;		/* full wakeup handshakes */
+	u32 wake_skips;		/* wakeups saved by the idle window */
+	u32 sleeps;		/* times the chip was allowed to sleep */
+	u64 wake_ns;		/* total time spent in wakeup handshakes */
+	u32 wake_ns_max;
+	u32 wake_fails;		/* clocks never came up before the deadline */
+	u32 fw_busy;		/* firmware still busy when allowing sleep */
+	/* wakeup latency, bucket n counts wakeups below 16us << n */
+	u32 wake_hist[WILC_WAKE_HIST_BUCKETS];
+};
+
+#define WILC_AUTOSLEEP_MAX_MS	100
+
+/*
+ * Bus arbitration classes, highest priority first. A caller waits in
+ * acquire_bus_prio() while anyone of a higher class wants or holds the bus.
+ * Only the order of acquisition is arbitrated: a holder is never preempted,
+ * so bulk users bound their own hold time by releasing between units the
+ * chip is consistent after, a section for the WiFi firmware and a block for
+ * the BT one.
+ */
+enum wilc_bus_prio {
+	WILC_BUS_PRIO_RX = 0,	/* interrupt service */
+	WILC_BUS_PRIO_CTRL,	/* config, init, power handling */
+	WILC_BUS_PRIO_TX,	/* data path */
+	WILC_BUS_PRIO_BULK,	/* firmware download, BT */
+	WILC_BUS_PRIO_MAX
+};
+
+/* longest a class waits for higher ones before queueing anyway */
+#define WILC_BUS_MAX_WAIT_MS	20
+
+struct wilc_bus_stats {
+	u32 acquires;
+	u32 contended;		/* had to wait behind a higher class */
+	u32 starved;		/* gave up waiting after WILC_BUS_MAX_WAIT_MS */
+	u64 wait_ns;
+	u32 wait_ns_max;
+	u32 hold_ns_max;
+};
+
+struct wilc_bus_arb {
+	spinlock_t lock;
+	wait_queue_head_t wq;
+	unsigned int pending[WILC_BUS_PRIO_MAX];	/* waiting or holding */
+	/* owner state, under hif_cs */
+	enum wilc_bus_prio prio;
+	ktime_t granted_at;
+	struct wilc_bus_stats stats[WILC_BUS_PRIO_MAX];
+	struct dentry *dentry;
+};
+
 struct wilc_hif_func {
 	int (*hif_init)(struct wilc *wilc, bool resume);
 	int (*hif_deinit)(struct wilc *wilc);
@@ -290,8 +418,75 @@ struct wilc_hif_func {
 	void (*disable_interrupt)(struct wilc *nic);
 	int (*hif_reset)(struct wilc *wilc);
 	bool (*hif_is_init)(struct wilc *wilc);
+	/* optional, keep tx_buffer/rx_buffer mapped for the bus DMA */
+	int (*hif_dma_map)(struct wilc *wilc);
+	void (*hif_dma_unmap)(struct wilc *wilc);
+	/*
+	 * optional, queue a block_tx_ext and return once it is on its way;
+	 * @done gets 1/0 like the other ops and may run in irq context
+	 */
+	int (*hif_block_tx_ext_async)(struct wilc *wilc, u32 addr, u8 *buf,
+				      u32 size,
+				      void (*done)(struct wilc *wilc,
+						   void *priv, int ret),
+				      void *priv);
+	/*
+	 * optional, run @n register ops in order in as few bus transactions
+	 * as possible; see wilc_hif_batch()
+	 */
+	int (*hif_batch)(struct wilc *wilc, struct wilc_reg_op *ops, int n);
+	/* optional, hold the bus for a whole acquire_bus()/release_bus() */
+	void (*hif_claim_bus)(struct wilc *wilc);
+	void (*hif_release_bus)(struct wilc *wilc);
 };
 
+/*
+ * Hot-path bus calls. Each module links the core with exactly one bus
+ * backend, so with WILC_HIF_DIRECT the core binds to that backend's
+ * wilc_bus_*() functions at link time instead of calling through
+ * wilc->hif_func.
+ */
+#ifdef WILC_HIF_DIRECT
+int wilc_bus_read_reg(struct wilc *wilc, u32 addr, u32 *data);
+int wilc_bus_write_reg(struct wilc *wilc, u32 addr, u32 data);
+int wilc_bus_block_rx(struct wilc *wilc, u32 addr, u8 *buf, u32 size);
+int wilc_bus_block_tx(struct wilc *wilc, u32 addr, u8 *buf, u32 size);
+int wilc_bus_read_int(struct wilc *wilc, u32 *int_status);
+int wilc_bus_clear_int_ext(struct wilc *wilc, u32 val);
+int wilc_bus_read_size(struct wilc *wilc, u32 *size);
+int wilc_bus_block_tx_ext(struct wilc *wilc, u32 addr, u8 *buf, u32 size);
+int wilc_bus_block_rx_ext(struct wilc *wilc, u32 addr, u8 *buf, u32 size);
+
+#define wilc_hif_read_reg(w, a, d)	wilc_bus_read_reg(w, a, d)
+#define wilc_hif_write_reg(w, a, d)	wilc_bus_write_reg(w, a, d)
+#define wilc_hif_block_rx(w, a, b, s)	wilc_bus_block_rx(w, a, b, s)
+#define wilc_hif_block_tx(w, a, b, s)	wilc_bus_block_tx(w, a, b, s)
+#define wilc_hif_read_int(w, i)		wilc_bus_read_int(w, i)
+#define wilc_hif_clear_int_ext(w, v)	wilc_bus_clear_int_ext(w, v)
+#define wilc_hif_read_size(w, s)	wilc_bus_read_size(w, s)
+#define wilc_hif_block_tx_ext(w, a, b, s) wilc_bus_block_tx_ext(w, a, b, s)
+#define wilc_hif_block_rx_ext(w, a, b, s) wilc_bus_block_rx_ext(w, a, b, s)
+#else
+#define wilc_hif_read_reg(w, a, d) \
+	((w)->hif_func->hif_read_reg(w, a, d))
+#define wilc_hif_write_reg(w, a, d) \
+	((w)->hif_func->hif_write_reg(w, a, d))
+#define wilc_hif_block_rx(w, a, b, s) \
+	((w)->hif_func->hif_block_rx(w, a, b, s))
+#define wilc_hif_block_tx(w, a, b, s) \
+	((w)->hif_func->hif_block_tx(w, a, b, s))
+#define wilc_hif_read_int(w, i) \
+	((w)->hif_func->hif_read_int(w, i))
+#define wilc_hif_clear_int_ext(w, v) \
+	((w)->hif_func->hif_clear_int_ext(w, v))
+#define wilc_hif_read_size(w, s) \
+	((w)->hif_func->hif_read_size(w, s))
+#define wilc_hif_block_tx_ext(w, a, b, s) \
+	((w)->hif_func->hif_block_tx_ext(w, a, b, s))
+#define wilc_hif_block_rx_ext(w, a, b, s) \
+	((w)->hif_func->hif_block_rx_ext(w, a, b, s))
+#endif
+
 #define MAX_CFG_FRAME_SIZE	1468
 
 struct wilc_cfg_frame {
@@ -345,11 +540,38 @@ void eap_buff_timeout(struct timer_list *t);
 #else
 void eap_buff_timeout(unsigned long user);
 #endif
+void wilc_reg_shadow_init(struct wilc *wilc);
+void wilc_reg_shadow_invalidate(struct wilc *wilc);
+int wilc_reg_read(struct wilc *wilc, u32 addr, u32 *val);
+int wilc_reg_write(struct wilc *wilc, u32 addr, u32 val);
+int wilc_hif_batch(struct wilc *wilc, struct wilc_reg_op *ops, int n);
+int wilc_hif_batch_seq(struct wilc *wilc, struct wilc_reg_op *ops, int n);
+int wilc_poll_reg(struct wilc *wilc, u32 addr, u32 mask, u32 val,
+		  unsigned int spin, unsigned int timeout_us);
+void wilc_autosleep_init(struct wilc *wilc);
+void wilc_autosleep_deinit(struct wilc *wilc);
+void wilc_autosleep_flush(struct wilc *wilc);
+void wilc_autosleep_set(struct wilc *wilc, int idle_ms, int max_ms);
+void wilc_bus_arb_init(struct wilc *wilc);
+void wilc_bus_arb_deinit(struct wilc *wilc);
+void acquire_bus_prio(struct wilc *wilc, enum bus_acquire acquire, int source,
+		      enum wilc_bus_prio prio);
 void acquire_bus(struct wilc *wilc, enum bus_acquire acquire, int source);
 void release_bus(struct wilc *wilc, enum bus_release release, int source);
 int wilc_wlan_init(struct net_device *dev);
 u32 wilc_get_chipid(struct wilc *wilc, bool update);
+int wilc_chip_select(struct wilc *wilc, u32 chipid);
+extern const struct wilc_chip_ops wilc1000_ops;
+extern const struct wilc_chip_ops wilc3000_ops;
 void wilc_frmw_to_linux(struct wilc_vif *vif, u8 *buff, u32 size,
 				u32 pkt_offset, u8 status);
+void wilc_frmw_to_linux_list(struct wilc_vif *vif, u8 *buff, u32 size,
+			     u32 pkt_offset, struct sk_buff_head *list);
+void wilc_rx_list_deliver(struct sk_buff_head *list);
 void wilc_wfi_handle_monitor_rx(struct wilc *wilc, u8 *buff, u32 size);
+void wilc_rx_demux_update(struct wilc *wilc);
+int wilc_wlan_ctrl_rx_init(struct wilc *wilc);
+void wilc_wlan_ctrl_rx_deinit(struct wilc *wilc);
+struct wilc_vif *wilc_rx_demux_mon_vif(struct wilc *wilc);
+struct wilc_vif *wilc_rx_demux_mgmt_vif(struct wilc *wilc);
 #endif
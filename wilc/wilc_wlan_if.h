@@ -8,8 +8,14 @@
 #define WILC_WLAN_IF_H
 
 #include <linux/netdevice.h>
+#include <linux/version.h>
 #include "wilc_debugfs.h"
 
+/* native XDP, needs the xdp_buff/ndo_xdp_xmit API of 5.13 and later */
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE
+#define WILC_XDP
+#endif
+
 /********************************************
  *
  *      Host Interface Defines
@@ -58,6 +64,9 @@ struct tx_complete_data {
 	void *buff;
 	u8 *bssid;
 	struct sk_buff *skb;
+#ifdef WILC_XDP
+	struct xdp_frame *xdpf;
+#endif
 	struct wilc_vif *vif;
 };
 